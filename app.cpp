@@ -7,11 +7,13 @@
 #include <imgui_impl_opengl3.h>
 #include <implot.h>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
 
 #include <OpenImageIO/imageio.h>
@@ -22,8 +24,11 @@
 #include <ATen/ATen.h> // c10::InferenceMode
 #include <torch/torch.h>
 
+#include "viscor/catalog.h"
 #include "viscor/imgui-utils.h"
+#include "viscor/memory.h"
 #include "viscor/raii.h"
+#include "viscor/session.h"
 #include "viscor/utils.h"
 
 using namespace VisCor;
@@ -32,9 +37,25 @@ struct AppArgs {
   std::string image0Path;
   std::string image1Path;
   std::string feat0Path;
-  std::string feat1Path;
+  std::vector<std::string> feat1Paths;
   bool fix01Scale = false;
   float heatmapAlpha = 0.6;
+  bool noIdle = false;
+  double idleTimeout = 0.5;
+  std::string keypointsPath;
+  std::string scoreChannel;
+  double scoreThreshold = 0.015;
+  int maxKeypoints = 4096;
+  std::string recordPath;
+  std::string replayPath;
+  bool headless = false;
+  double frameBudgetMs = 1000.0 / 60.0;
+  bool lazyQuery = false;
+  std::string catalogPath;
+  double memoryBudgetMB = 0;
+  std::string cacheDir;
+  double cacheSizeMB = 1024;
+  std::string exportDir = ".";
 
   AppArgs(int argc, char *argv[]) {
     using namespace clipp;
@@ -43,7 +64,8 @@ struct AppArgs {
 
     auto cli =
         (value("Path to the first featuremap", feat0Path),
-         value("Path to the second featuremap", feat1Path),
+         values("Paths to the second featuremaps, compared side by side",
+                feat1Paths),
          option("--image0").set(image0set) & value("path", image0Path),
          option("--image1").set(image1set) & value("path", image1Path),
          option("-01", "--fix-01-scale")
@@ -52,7 +74,66 @@ struct AppArgs {
                   "current min/max values"),
          option("-a", "--heatmap-alpha") &
              value("alpha", heatmapAlpha) %
-                 "Transparency of the heatmap overlay");
+                 "Transparency of the heatmap overlay",
+         option("--no-idle")
+             .set(noIdle)
+             .doc("Redraw continuously instead of sleeping until an input "
+                  "event arrives or the heatmap changes"),
+         option("--idle-timeout") &
+             value("seconds", idleTimeout) %
+                 "Upper bound on how long to sleep between frames when idle",
+         option("--keypoints") &
+             value("path", keypointsPath) %
+                 "Evaluate the heatmap only at the keypoints listed in a json "
+                 "file ({\"keypoints\": [[x, y], ...]}, in pixels of the "
+                 "second featuremap)",
+         option("--score-channel") &
+             value("name", scoreChannel) %
+                 "Evaluate the heatmap only at the keypoints with the highest "
+                 "values in this channel of the second featuremap",
+         option("--score-threshold") &
+             value("score", scoreThreshold) %
+                 "Ignore keypoints scoring at or below this value",
+         option("--max-keypoints") &
+             value("n", maxKeypoints) %
+                 "How many of the top-scoring keypoints to keep",
+         option("--record") &
+             value("path", recordPath) %
+                 "Record the queries and toolbox settings with timestamps",
+         option("--replay") &
+             value("path", replayPath) %
+                 "Replay a recorded session, print a json latency report to "
+                 "stdout and exit",
+         option("--headless")
+             .set(headless)
+             .doc("Don't show the window (e.g. for --replay under llvmpipe)"),
+         option("--frame-budget") &
+             value("ms", frameBudgetMs) %
+                 "Replayed events presented later than this count as late",
+         option("--lazy-query")
+             .set(lazyQuery)
+             .doc("Don't load the first featuremap; read the queried pixels "
+                  "from the file on demand (fastest with tiled EXRs)"),
+         option("--catalog") &
+             value("path", catalogPath) %
+                 "Catalog made by `exrinfo index`, used to validate the "
+                 "featuremaps before loading them and to read tiled query "
+                 "featuremaps lazily",
+         option("--memory-budget") &
+             value("MiB", memoryBudgetMB) %
+                 "Load featuremaps at half precision or lazily, and shrink "
+                 "caches, rather than use more memory than this (0 for no "
+                 "limit)",
+         option("--cache-dir") &
+             value("path", cacheDir) %
+                 "Keep computed slices here and reuse them across sessions, "
+                 "keyed by the contents of the featuremaps",
+         option("--cache-size") &
+             value("MiB", cacheSizeMB) %
+                 "Evict the least recently used results beyond this size",
+         option("--export-dir") &
+             value("path", exportDir) %
+                 "Directory the \"Export heatmaps\" button writes to");
 
     if (!clipp::parse(argc, argv, cli)) {
       std::cerr << make_man_page(cli, argv[0]);
@@ -67,12 +148,65 @@ struct AppArgs {
   }
 };
 
+/* Checks the featuremaps against the catalog without opening them */
+void checkCatalog(AppArgs &args) {
+  const auto catalog = Catalog::load(args.catalogPath);
+
+  const auto lookup = [&](const std::string &path) {
+    const auto *entry = catalog.find(path);
+    if (!entry) {
+      std::cerr << path << " isn't in the catalog or has changed since it was "
+                << "indexed" << std::endl;
+    }
+    return entry;
+  };
+  /* The catalog's own count doesn't know about --score-channel */
+  const auto channelCount = [&](const CatalogEntry &entry) {
+    return (int)descriptorChannels(entry.channelNames, args.scoreChannel)
+        .size();
+  };
+
+  const auto *feat0 = lookup(args.feat0Path);
+  std::optional<std::tuple<int, int, int>> shape1;
+  for (const auto &path : args.feat1Paths) {
+    const auto *feat1 = lookup(path);
+    if (!feat1) {
+      continue;
+    }
+    const auto shape =
+        std::make_tuple(feat1->height, feat1->width, channelCount(*feat1));
+    if (shape1 && *shape1 != shape) {
+      std::cerr << path << " doesn't have the same shape as the other second "
+                << "featuremaps" << std::endl;
+      std::exit(1);
+    }
+    shape1 = shape;
+    if (feat0 && channelCount(*feat0) != channelCount(*feat1)) {
+      std::cerr << path << " has " << channelCount(*feat1)
+                << " descriptor channels, but " << args.feat0Path << " has "
+                << channelCount(*feat0) << std::endl;
+      std::exit(1);
+    }
+  }
+
+  if (feat0 && feat0->tiled() && !args.lazyQuery) {
+    std::cerr << args.feat0Path << " is tiled, reading it lazily" << std::endl;
+    args.lazyQuery = true;
+  }
+}
+
 int main(int argc, char *argv[]) {
 
   AppArgs args(argc, argv);
+  if (!args.catalogPath.empty()) {
+    checkCatalog(args);
+  }
+
+  auto &memory = MemoryRegistry::instance();
+  memory.setBudget(args.memoryBudgetMB * (1 << 20));
 
   SafeGlfwCtx ctx;
-  SafeGlfwWindow safeWindow;
+  SafeGlfwWindow safeWindow(!args.headless);
   safeWindow.makeContextCurrent();
 
   GLFWwindow *window = safeWindow.window();
@@ -86,17 +220,112 @@ int main(int argc, char *argv[]) {
 
   std::cerr << "Using " << device << std::endl;
 
+  auto feats1 =
+      loadExrFieldBatch(args.feat1Paths, device, args.scoreChannel);
+
+  if (!args.lazyQuery) {
+    const auto [h, w, c] = exrFieldShape(args.feat0Path, args.scoreChannel);
+    if (!memory.fits((size_t)h * w * c * sizeof(float))) {
+      std::cerr << args.feat0Path << " doesn't fit in the memory budget, "
+                << "reading it lazily" << std::endl;
+      args.lazyQuery = true;
+    }
+  }
+
+  std::unique_ptr<QueryField> feat0;
+  if (args.lazyQuery) {
+    constexpr size_t MiB = 1 << 20;
+    const float cacheMB =
+        std::clamp<size_t>(memory.available() / 4 / MiB, 8, 64);
+    feat0 = std::make_unique<LazyExrField>(args.feat0Path, device, cacheMB,
+                                           args.scoreChannel);
+  } else {
+    feat0 = std::make_unique<DescriptorField>(loadExrField(
+        args.feat0Path, device, torch::kF32, args.scoreChannel));
+  }
+
   ImHeatSlice heatView(
-      loadExrField(args.feat0Path, device),
-      loadExrField(args.feat1Path, device),
-      SafeGlTexture(oiioLoadImage(args.image0Path), GL_NEAREST),
-      SafeGlTexture(oiioLoadImage(args.image1Path), GL_NEAREST), device,
+      std::move(feat0), std::move(feats1),
+      std::vector<std::string>(args.feat1Paths),
+      SafeGlTexture(oiioLoadImageHalf(args.image0Path), GL_NEAREST),
+      SafeGlTexture(oiioLoadImageHalf(args.image1Path), GL_NEAREST), device,
       args.fix01Scale);
 
+  if (!args.cacheDir.empty()) {
+    auto cache = std::make_unique<ResultCache>(
+        args.cacheDir, (size_t)(args.cacheSizeMB * (1 << 20)));
+    CacheKey inputs("inputs");
+    /* A lazily read query field is too large to hash in full before the
+     * first frame; key it by its identity instead */
+    inputs.add(args.lazyQuery ? ResultCache::fileIdentity(args.feat0Path)
+                              : cache->fileHash(args.feat0Path));
+    for (const auto &path : args.feat1Paths) {
+      inputs.add(cache->fileHash(path));
+    }
+    /* The score channel is left out of the descriptors it's stored with */
+    inputs.add(args.scoreChannel.data(), args.scoreChannel.size());
+    heatView.setResultCache(std::move(cache), inputs.value());
+  }
+
+  if (!args.keypointsPath.empty()) {
+    heatView.setKeypoints(loadKeypointsJson(
+        args.keypointsPath, heatView.desc1.front().h(),
+        heatView.desc1.front().w()));
+  } else if (!args.scoreChannel.empty()) {
+    heatView.setKeypoints(keypointsFromScoreChannel(
+        args.feat1Paths.front(), args.scoreChannel, args.scoreThreshold,
+        args.maxKeypoints));
+  }
+  if (heatView.sparse()) {
+    std::cerr << "Sparse mode: " << heatView.heat.size(1) << " keypoints"
+              << std::endl;
+  }
+
+  std::unique_ptr<SessionRecorder> recorder;
+  if (!args.recordPath.empty()) {
+    recorder = std::make_unique<SessionRecorder>(args.recordPath);
+  }
+  std::unique_ptr<SessionReplay> replay;
+  if (!args.replayPath.empty()) {
+    replay = std::make_unique<SessionReplay>(args.replayPath,
+                                             args.frameBudgetMs);
+  }
+
   constexpr auto defaultWindowOptions = ImGuiWindowFlags_NoDecoration |
                                         ImGuiWindowFlags_NoBackground |
                                         ImGuiWindowFlags_NoResize;
+
+  /* ImGui needs a couple of frames after an input event to settle hovered and
+   * active states, so we keep drawing for a few frames after each wake-up or
+   * change before going back to sleep */
+  constexpr int settleFrames = 3;
+  int framesToDraw = settleFrames;
+
   while (!glfwWindowShouldClose(window)) {
+    if (replay) {
+      /* The previous frame has been swapped at the end of the last iteration;
+       * wait until it's actually been drawn */
+      glFinish();
+      replay->presented();
+      if (replay->done()) {
+        break;
+      }
+      replay->apply(heatView);
+    } else if (args.noIdle) {
+      // Busy redraw, as before
+    } else if (framesToDraw > 0) {
+      --framesToDraw;
+    } else {
+      using clock = std::chrono::steady_clock;
+      const auto sleepStart = clock::now();
+      glfwWaitEventsTimeout(args.idleTimeout);
+      const std::chrono::duration<double> slept = clock::now() - sleepStart;
+
+      // Woken by an event rather than by the timeout
+      if (slept.count() < args.idleTimeout) {
+        framesToDraw = settleFrames;
+      }
+    }
 
     GlfwFrame glfwFrame(window);
     ImGuiGlfwFrame imguiFrame;
@@ -106,7 +335,7 @@ int main(int argc, char *argv[]) {
     } glfwSize;
     glfwGetWindowSize(window, &glfwSize.x, &glfwSize.y);
 
-    const auto toolboxHeight = ImGui::GetTextLineHeightWithSpacing() * 6;
+    const auto toolboxHeight = ImGui::GetTextLineHeightWithSpacing() * 8;
     ImGui::SetNextWindowPos(ImVec2(0, 0));
     ImGui::SetNextWindowSizeConstraints(ImVec2(glfwSize.x, toolboxHeight),
                                         ImVec2(glfwSize.x, toolboxHeight));
@@ -116,12 +345,45 @@ int main(int argc, char *argv[]) {
       heatView.alpha = normalizeAlpha(heatView.alpha);
 
       ImGui::Checkbox("exp", &heatView.newQuery.exp);
+      if (!heatView.sparse()) {
+        ImGui::SameLine();
+        if (ImGui::Button("Export heatmaps")) {
+          try {
+            for (const auto &path : heatView.exportHeatmaps(args.exportDir)) {
+              std::cerr << "Wrote " << path << std::endl;
+            }
+          } catch (const std::exception &e) {
+            std::cerr << "Export failed: " << e.what() << std::endl;
+          }
+        }
+      }
+
+      ImGui::SliderFloat("Exposure", &heatView.exposure, -8.0, 8.0, "%.1f");
+      ImGui::SliderFloat("Gamma", &heatView.gamma, 1.0, 3.0, "%.2f");
+
+      constexpr double MiB = 1 << 20;
+      if (memory.budget() > 0) {
+        ImGui::Text("Memory: %.1f of %.1f MiB", memory.used() / MiB,
+                    memory.budget() / MiB);
+      } else {
+        ImGui::Text("Memory: %.1f MiB", memory.used() / MiB);
+      }
+      if (ImGui::IsItemHovered()) {
+        ImGui::BeginTooltip();
+        for (const auto &e : memory.breakdown()) {
+          if (e.bytes > 0) {
+            ImGui::Text("%s / %s: %.1f MiB", e.category.c_str(),
+                        e.name.c_str(), e.bytes / MiB);
+          }
+        }
+        ImGui::EndTooltip();
+      }
     }
     ImGui::End();
 
     const auto workArea = ImVec2(glfwSize.x, glfwSize.y - toolboxHeight);
     const auto neededArea =
-        ImVec2(workArea.x, .5 * workArea.x * heatView.image0.aspect());
+        ImVec2(workArea.x, workArea.x * heatView.aspect());
     ImGui::SetNextWindowPos(ImVec2(0, toolboxHeight));
     ImGui::SetNextWindowSizeConstraints(
         neededArea,
@@ -130,6 +392,18 @@ int main(int argc, char *argv[]) {
     ImGui::Begin("Window0", nullptr, defaultWindowOptions);
     heatView.draw();
     ImGui::End();
+
+    if (heatView.takeDirty()) {
+      framesToDraw = settleFrames;
+    }
+    if (recorder) {
+      recorder->record(heatView.query, heatView.alpha, heatView.exposure,
+                       heatView.gamma);
+    }
+  }
+
+  if (replay) {
+    std::cout << replay->report().json() << std::endl;
   }
   return 0;
 }
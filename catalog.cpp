@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <thread>
+
+#include <unistd.h>
+
+#include "viscor/catalog.h"
+
+using namespace VisCor;
+using json = nlohmann::json;
+
+namespace {
+constexpr int catalogVersion = 1;
+
+std::atomic<uint64_t> tmpCounter = 0;
+
+int64_t mtimeOf(const fs::path &path) {
+  return fs::last_write_time(path).time_since_epoch().count();
+}
+
+std::string key(const fs::path &path) {
+  return fs::weakly_canonical(path).string();
+}
+
+CatalogEntry readHeader(const fs::path &path) {
+  using namespace OIIO;
+  CatalogEntry e;
+  e.mtime = mtimeOf(path);
+  e.size = fs::file_size(path);
+
+  auto in = ImageInput::open(path.string());
+  if (!in)
+    throw std::runtime_error("Couldn't open " + path.string());
+  const ImageSpec &spec = in->spec();
+
+  e.width = spec.width;
+  e.height = spec.height;
+  e.channelNames = spec.channelnames;
+  for (int c = 0; c < spec.nchannels; ++c) {
+    e.channelFormats.push_back(spec.channelformat(c).c_str());
+  }
+  e.descriptorChannels = descriptorChannels(spec).size();
+  e.tileWidth = spec.tile_width;
+  e.tileHeight = spec.tile_height;
+  return e;
+}
+
+json toJson(const CatalogEntry &e) {
+  return {{"mtime", e.mtime},
+          {"size", e.size},
+          {"width", e.width},
+          {"height", e.height},
+          {"channels", e.channelNames},
+          {"formats", e.channelFormats},
+          {"descriptorChannels", e.descriptorChannels},
+          {"tile", {e.tileWidth, e.tileHeight}}};
+}
+
+CatalogEntry fromJson(const json &j) {
+  CatalogEntry e;
+  e.mtime = j.at("mtime");
+  e.size = j.at("size");
+  e.width = j.at("width");
+  e.height = j.at("height");
+  e.channelNames = j.at("channels").get<std::vector<std::string>>();
+  e.channelFormats = j.at("formats").get<std::vector<std::string>>();
+  e.descriptorChannels = j.at("descriptorChannels");
+  e.tileWidth = j.at("tile").at(0);
+  e.tileHeight = j.at("tile").at(1);
+  return e;
+}
+} // namespace
+
+std::vector<std::string>
+VisCor::descriptorChannels(const OIIO::ImageSpec &spec,
+                           const std::string &scoreChannel) {
+  return descriptorChannels(spec.channelnames, scoreChannel);
+}
+
+std::vector<std::string>
+VisCor::descriptorChannels(const std::vector<std::string> &channelNames,
+                           const std::string &scoreChannel) {
+  std::vector<std::string> descChannels;
+  for (const auto &c : channelNames) {
+    // if (!c.starts_with("superglue."))
+    //   continue;
+
+    //   FIXME:
+    if (c.find(".") == std::string::npos || c == scoreChannel)
+      continue;
+    descChannels.push_back(c);
+  }
+  return descChannels;
+}
+
+bool VisCor::CatalogEntry::upToDate(const fs::path &path) const {
+  std::error_code ec;
+  const auto currentSize = fs::file_size(path, ec);
+  if (ec)
+    return false;
+  return currentSize == size && mtimeOf(path) == mtime;
+}
+
+Catalog VisCor::Catalog::load(const fs::path &path) {
+  Catalog catalog;
+  std::ifstream in(path);
+  if (!in)
+    return catalog;
+
+  /* A corrupt catalog is as good as none, it just gets rebuilt */
+  try {
+    json j;
+    in >> j;
+    if (j.value("version", 0) != catalogVersion)
+      return catalog;
+
+    for (const auto &[file, entry] : j.at("files").items()) {
+      catalog._entries.emplace(file, fromJson(entry));
+    }
+  } catch (const json::exception &) {
+    return Catalog();
+  }
+  return catalog;
+}
+
+void VisCor::Catalog::save(const fs::path &path) const {
+  json files = json::object();
+  for (const auto &[file, entry] : _entries) {
+    files[file] = toJson(entry);
+  }
+
+  /* Write next to the target and rename, so that a reader never sees half a
+   * catalog. The temporary name is unique per process and per save, since
+   * several indexers may update the same catalog */
+  const auto tmpPath =
+      fs::path(path.string() + "." + std::to_string(getpid()) + "." +
+               std::to_string(tmpCounter++) + ".tmp");
+  std::error_code ec;
+  {
+    std::ofstream out(tmpPath);
+    if (!out)
+      throw std::runtime_error("Couldn't write " + tmpPath.string());
+    out << json{{"version", catalogVersion}, {"files", files}}.dump();
+    out.close();
+    if (!out) {
+      fs::remove(tmpPath, ec);
+      throw std::runtime_error("Couldn't write " + tmpPath.string());
+    }
+  }
+  fs::rename(tmpPath, path, ec);
+  if (ec) {
+    const auto error = ec.message();
+    fs::remove(tmpPath, ec);
+    throw std::runtime_error("Couldn't replace " + path.string() + ": " +
+                             error);
+  }
+}
+
+int VisCor::Catalog::update(const fs::path &root, int threads) {
+  const auto rootKey = key(root);
+
+  std::vector<fs::path> todo;
+  std::map<std::string, CatalogEntry> kept;
+  for (const auto &f : fs::recursive_directory_iterator(
+           root, fs::directory_options::skip_permission_denied)) {
+    if (!f.is_regular_file() || f.path().extension() != ".exr")
+      continue;
+
+    const auto k = key(f.path());
+    const auto it = _entries.find(k);
+    if (it != _entries.end() && it->second.upToDate(f.path())) {
+      kept.emplace(k, it->second);
+    } else {
+      todo.push_back(f.path());
+    }
+  }
+
+  std::vector<std::optional<CatalogEntry>> results(todo.size());
+  std::atomic<size_t> next = 0;
+  const auto worker = [&]() {
+    for (size_t i = next++; i < todo.size(); i = next++) {
+      try {
+        results[i] = readHeader(todo[i]);
+      } catch (const std::exception &) {
+        // Not an image we can read; leave it out of the catalog
+      }
+    }
+  };
+
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<size_t>(threads, std::max<size_t>(todo.size(), 1));
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; ++t) {
+    pool.emplace_back(worker);
+  }
+  for (auto &t : pool) {
+    t.join();
+  }
+
+  /* Forget whatever used to be under root, keeping other roots' files; the
+   * separator keeps /data/ab from counting as under /data/a */
+  auto rootPrefix = rootKey;
+  if (rootPrefix.empty() || rootPrefix.back() != fs::path::preferred_separator)
+    rootPrefix += fs::path::preferred_separator;
+  for (auto it = _entries.begin(); it != _entries.end();) {
+    if (it->first == rootKey || it->first.rfind(rootPrefix, 0) == 0) {
+      it = _entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  _entries.merge(kept);
+
+  int read = 0;
+  for (size_t i = 0; i < todo.size(); ++i) {
+    if (results[i]) {
+      _entries.insert_or_assign(key(todo[i]), std::move(*results[i]));
+      ++read;
+    }
+  }
+  return read;
+}
+
+const CatalogEntry *VisCor::Catalog::find(const fs::path &path) const {
+  std::error_code ec;
+  const auto k = fs::weakly_canonical(path, ec);
+  if (ec)
+    return nullptr;
+  const auto it = _entries.find(k.string());
+  if (it == _entries.end() || !it->second.upToDate(path))
+    return nullptr;
+  return &it->second;
+}
@@ -2,13 +2,16 @@
 #include <clipp.h>
 #include <iostream>
 
+#include "viscor/catalog.h"
+
 int main(int argc, char **argv) {
   using namespace clipp;
   using namespace OIIO;
 
   std::string path, outPath;
+  int threads = 0;
 
-  enum class Mode { Shape, LsChannels, Help, Export };
+  enum class Mode { Shape, LsChannels, Help, Export, Index };
   Mode mode(Mode::Shape);
 
   {
@@ -16,7 +19,15 @@ int main(int argc, char **argv) {
     auto cli = (((command("shape").set(mode, Mode::Shape), inPath) |
                  (command("ls-channels").set(mode, Mode::LsChannels), inPath) |
                  (command("export").set(mode, Mode::Export),
-                  option("-o", "--output") & value("path", outPath), inPath)) |
+                  option("-o", "--output") & value("path", outPath), inPath) |
+                 (command("index").set(mode, Mode::Index),
+                  option("-o", "--output") &
+                      value("catalog", outPath) %
+                          "Where to keep the catalog (default: "
+                          "<dir>/exrcatalog.json)",
+                  option("-j", "--threads") &
+                      value("n", threads) % "Threads to read headers with",
+                  value("Directory to index", path))) |
                 command("--help").set(mode, Mode::Help));
 
     if (!parse(argc, argv, cli) || mode == Mode::Help) {
@@ -29,6 +40,18 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (mode == Mode::Index) {
+    const auto catalogPath =
+        outPath.empty() ? std::filesystem::path(path) / "exrcatalog.json"
+                        : std::filesystem::path(outPath);
+    auto catalog = VisCor::Catalog::load(catalogPath);
+    const auto read = catalog.update(path, threads);
+    catalog.save(catalogPath);
+    std::cerr << "Read " << read << " headers, " << catalog.entries().size()
+              << " files in " << catalogPath << std::endl;
+    return 0;
+  }
+
   std::unique_ptr<ImageInput> in = ImageInput::open(path);
   if (!in) {
     std::cerr << "Couldn't load " << path << std::endl;
@@ -91,7 +114,8 @@ int main(int argc, char **argv) {
 
     break;
   }
-  case Mode::Help: {
+  case Mode::Help:
+  case Mode::Index: {
     std::cerr << "Mode::help should have already been handled" << std::endl;
     std::exit(1);
   }
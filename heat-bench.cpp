@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <chrono>
+#include <clipp.h>
+#include <iostream>
+#include <vector>
+
+#include <ATen/Parallel.h>
+#include <torch/torch.h>
+
+#include "viscor/heat-kernels.h"
+
+/* Times the specialized heat kernels against the bmm path they replace, the
+ * same way ImHeatSlice::computeHeat runs both: [N, C, H, W] float fields on
+ * the cpu, the kernel under at::parallel_for */
+int main(int argc, char **argv) {
+  using namespace clipp;
+  using namespace VisCor;
+
+  int fields = 1, size = 1024, reps = 10, threads = 0;
+  std::vector<int> channels;
+
+  auto cli = (option("-n", "--fields") &
+                  value("n", fields) % "Second featuremaps per query",
+              option("-s", "--size") &
+                  value("px", size) % "Height and width of each featuremap",
+              option("-r", "--reps") & value("n", reps) % "Timed runs",
+              option("-j", "--threads") &
+                  value("n", threads) % "Torch threads (0 for the default)",
+              option("-c", "--channels") &
+                  values("c", channels) %
+                      "Channel counts to time (default: 64 128 256)");
+  if (!parse(argc, argv, cli)) {
+    std::cerr << make_man_page(cli, argv[0]);
+    return 1;
+  }
+  reps = std::max(reps, 1);
+  if (channels.empty()) {
+    channels = {64, 128, 256};
+  }
+  if (threads > 0) {
+    at::set_num_threads(threads);
+  }
+
+  at::NoGradGuard noGrad;
+  const int64_t n = fields, h = size, w = size;
+
+  /* Median of reps, after one warm-up run */
+  const auto time = [&](auto &&run) {
+    run();
+    std::vector<double> ms;
+    for (int r = 0; r < reps; ++r) {
+      const auto t0 = std::chrono::steady_clock::now();
+      run();
+      const auto t1 = std::chrono::steady_clock::now();
+      ms.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+    std::nth_element(ms.begin(), ms.begin() + ms.size() / 2, ms.end());
+    return ms[ms.size() / 2];
+  };
+
+  std::cout << "fields=" << n << " size=" << h << "x" << w
+            << " threads=" << at::get_num_threads() << std::endl;
+  for (const int64_t c : channels) {
+    const auto desc1Batch = torch::randn({n, c, h, w});
+    const auto query = torch::randn({c});
+    const auto q = query.reshape({1, 1, c}).expand({n, 1, c});
+
+    torch::Tensor bmmHeat;
+    const auto bmmMs = time([&] {
+      bmmHeat = q.bmm(desc1Batch.reshape({n, c, h * w})).reshape({n, h, w});
+    });
+
+    const auto kernel = selectHeatKernel(c);
+    if (!kernel) {
+      std::cout << "c=" << c << " bmm " << bmmMs
+                << " ms (no specialized kernel)" << std::endl;
+      continue;
+    }
+
+    auto kernelHeat = torch::empty({n, h, w});
+    const auto *fieldsPtr = desc1Batch.data_ptr<float>();
+    const auto *queryPtr = query.data_ptr<float>();
+    auto *heats = kernelHeat.data_ptr<float>();
+    const auto kernelMs = time([&] {
+      at::parallel_for(0, h * w, 1 << 14, [&](int64_t begin, int64_t end) {
+        for (int64_t i = 0; i < n; ++i) {
+          kernel.fn(fieldsPtr + i * c * h * w, h * w, queryPtr, c,
+                    heats + i * h * w, begin, end);
+        }
+      });
+    });
+
+    const auto maxError = (kernelHeat - bmmHeat).abs().max().item<double>();
+    std::cout << "c=" << c << " bmm " << bmmMs << " ms, " << kernel.name << " "
+              << kernelMs << " ms (" << bmmMs / kernelMs
+              << "x), max abs difference " << maxError << std::endl;
+  }
+  return 0;
+}
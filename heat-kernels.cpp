@@ -0,0 +1,209 @@
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VISCOR_X86
+#endif
+
+#include "viscor/heat-kernels.h"
+
+using namespace VisCor;
+
+namespace {
+/* Pixels per chunk: the chunk's heat stays in L1 while all the channels are
+ * accumulated into it, and each channel is read as a contiguous run */
+constexpr int64_t chunk = 1024;
+/* Channels accumulated per pass over a chunk, each with its own broadcast
+ * query register */
+constexpr int group = 8;
+
+/* Accumulates channels [k, k + group) into heat[p0, p1) with scalars */
+inline void accumulateTail(const float *field, int64_t stride,
+                           const float *query, int k, float *heat, int64_t p0,
+                           int64_t p1) {
+  for (int64_t p = p0; p < p1; ++p) {
+    auto acc = heat[p];
+    for (int g = 0; g < group; ++g) {
+      acc += query[k + g] * field[(k + g) * stride + p];
+    }
+    heat[p] = acc;
+  }
+}
+
+template <int C>
+void heatFixed(const float *field, int64_t stride, const float *query, int,
+               float *heat, int64_t begin, int64_t end) {
+  static_assert(C % group == 0);
+  for (int64_t p0 = begin; p0 < end; p0 += chunk) {
+    const auto p1 = std::min(p0 + chunk, end);
+    std::fill(heat + p0, heat + p1, 0.0f);
+    for (int k = 0; k < C; k += group) {
+      accumulateTail(field, stride, query, k, heat, p0, p1);
+    }
+  }
+}
+
+#ifdef VISCOR_X86
+template <int C>
+__attribute__((target("avx2,fma"))) void
+heatAvx2(const float *field, int64_t stride, const float *query, int,
+         float *heat, int64_t begin, int64_t end) {
+  static_assert(C % group == 0);
+  constexpr int width = 8;
+  for (int64_t p0 = begin; p0 < end; p0 += chunk) {
+    const auto p1 = std::min(p0 + chunk, end);
+    const auto vecEnd = p0 + (p1 - p0) / width * width;
+    std::fill(heat + p0, heat + p1, 0.0f);
+
+    for (int k = 0; k < C; k += group) {
+      __m256 q[group];
+      for (int g = 0; g < group; ++g) {
+        q[g] = _mm256_set1_ps(query[k + g]);
+      }
+      const auto *f = field + k * stride;
+      for (int64_t p = p0; p < vecEnd; p += width) {
+        auto acc = _mm256_loadu_ps(heat + p);
+        for (int g = 0; g < group; ++g) {
+          acc = _mm256_fmadd_ps(q[g], _mm256_loadu_ps(f + g * stride + p), acc);
+        }
+        _mm256_storeu_ps(heat + p, acc);
+      }
+      accumulateTail(field, stride, query, k, heat, vecEnd, p1);
+    }
+  }
+}
+
+template <int C>
+__attribute__((target("avx512f"))) void
+heatAvx512(const float *field, int64_t stride, const float *query, int,
+           float *heat, int64_t begin, int64_t end) {
+  static_assert(C % group == 0);
+  constexpr int width = 16;
+  for (int64_t p0 = begin; p0 < end; p0 += chunk) {
+    const auto p1 = std::min(p0 + chunk, end);
+    const auto vecEnd = p0 + (p1 - p0) / width * width;
+    std::fill(heat + p0, heat + p1, 0.0f);
+
+    for (int k = 0; k < C; k += group) {
+      __m512 q[group];
+      for (int g = 0; g < group; ++g) {
+        q[g] = _mm512_set1_ps(query[k + g]);
+      }
+      const auto *f = field + k * stride;
+      for (int64_t p = p0; p < vecEnd; p += width) {
+        auto acc = _mm512_loadu_ps(heat + p);
+        for (int g = 0; g < group; ++g) {
+          acc = _mm512_fmadd_ps(q[g], _mm512_loadu_ps(f + g * stride + p), acc);
+        }
+        _mm512_storeu_ps(heat + p, acc);
+      }
+      accumulateTail(field, stride, query, k, heat, vecEnd, p1);
+    }
+  }
+}
+#endif
+
+inline uint32_t lookup(float v, float vmin, float scale, const uint32_t *lut,
+                       int lutSize) {
+  const auto t = (v - vmin) * scale;
+  const int i = t > 0 ? (int)std::min(t, lutSize - 1.0f) : 0;
+  return lut[i];
+}
+
+void colormapGeneric(const float *src, int64_t begin, int64_t n, float vmin,
+                     float scale, const uint32_t *lut, int lutSize,
+                     uint32_t *dst) {
+  for (int64_t p = begin; p < n; ++p) {
+    dst[p] = lookup(src[p], vmin, scale, lut, lutSize);
+  }
+}
+
+#ifdef VISCOR_X86
+__attribute__((target("avx2"))) int64_t
+colormapAvx2(const float *src, int64_t n, float vmin, float scale,
+             const uint32_t *lut, int lutSize, uint32_t *dst) {
+  constexpr int width = 8;
+  const auto vmin8 = _mm256_set1_ps(vmin);
+  const auto scale8 = _mm256_set1_ps(scale);
+  const auto zero = _mm256_setzero_ps();
+  const auto top = _mm256_set1_ps(lutSize - 1.0f);
+  int64_t p = 0;
+  for (; p + width <= n; p += width) {
+    auto t = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(src + p), vmin8),
+                           scale8);
+    /* maxps returns the second operand for NaNs */
+    t = _mm256_min_ps(_mm256_max_ps(t, zero), top);
+    const auto i = _mm256_cvttps_epi32(t);
+    const auto rgba = _mm256_i32gather_epi32((const int *)lut, i, 4);
+    _mm256_storeu_si256((__m256i *)(dst + p), rgba);
+  }
+  return p;
+}
+
+/* GCC 12 flags the undefined lanes the avx512f intrinsic headers start
+ * from as maybe-uninitialized once they are inlined here */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f"))) int64_t
+colormapAvx512(const float *src, int64_t n, float vmin, float scale,
+               const uint32_t *lut, int lutSize, uint32_t *dst) {
+  constexpr int width = 16;
+  const auto vmin16 = _mm512_set1_ps(vmin);
+  const auto scale16 = _mm512_set1_ps(scale);
+  const auto zero = _mm512_setzero_ps();
+  const auto top = _mm512_set1_ps(lutSize - 1.0f);
+  int64_t p = 0;
+  for (; p + width <= n; p += width) {
+    auto t = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(src + p), vmin16),
+                           scale16);
+    t = _mm512_min_ps(_mm512_max_ps(t, zero), top);
+    const auto i = _mm512_cvttps_epi32(t);
+    const auto rgba = _mm512_i32gather_epi32(i, (const int *)lut, 4);
+    _mm512_storeu_si512((void *)(dst + p), rgba);
+  }
+  return p;
+}
+#pragma GCC diagnostic pop
+#endif
+
+} // namespace
+
+#define VISCOR_SELECT(kernel)                                                  \
+  switch (c) {                                                                 \
+  case 64:                                                                     \
+    return {#kernel "<64>", kernel<64>};                                       \
+  case 128:                                                                    \
+    return {#kernel "<128>", kernel<128>};                                     \
+  case 256:                                                                    \
+    return {#kernel "<256>", kernel<256>};                                     \
+  }
+
+HeatKernel VisCor::selectHeatKernel(int c) {
+#ifdef VISCOR_X86
+  if (__builtin_cpu_supports("avx512f")) {
+    VISCOR_SELECT(heatAvx512)
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    VISCOR_SELECT(heatAvx2)
+  }
+#endif
+  VISCOR_SELECT(heatFixed)
+  return {};
+}
+
+void VisCor::colormapRgba8(const float *src, int64_t n, float vmin,
+                           float vmax, const uint32_t *lut, int lutSize,
+                           uint32_t *dst) {
+  const auto scale = vmax > vmin ? lutSize / (vmax - vmin) : 0.0f;
+  int64_t done = 0;
+#ifdef VISCOR_X86
+  static const bool avx512 = __builtin_cpu_supports("avx512f");
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  if (avx512) {
+    done = colormapAvx512(src, n, vmin, scale, lut, lutSize, dst);
+  } else if (avx2) {
+    done = colormapAvx2(src, n, vmin, scale, lut, lutSize, dst);
+  }
+#endif
+  colormapGeneric(src, done, n, vmin, scale, lut, lutSize, dst);
+}
@@ -0,0 +1,70 @@
+#ifndef _VISCOR_CATALOG_H
+#define _VISCOR_CATALOG_H
+
+#include <OpenImageIO/imageio.h>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace VisCor {
+
+namespace fs = std::filesystem;
+
+/* The channels of an EXR that make up the descriptor; scoreChannel, if the
+ * file has one, is stored alongside but isn't part of it */
+std::vector<std::string>
+descriptorChannels(const OIIO::ImageSpec &spec,
+                   const std::string &scoreChannel = "");
+/* The same, from channel names as stored in a catalog */
+std::vector<std::string>
+descriptorChannels(const std::vector<std::string> &channelNames,
+                   const std::string &scoreChannel = "");
+
+/* What we know about a file from its header alone */
+struct CatalogEntry {
+  int64_t mtime = 0;
+  uintmax_t size = 0;
+  int width = 0;
+  int height = 0;
+  std::vector<std::string> channelNames;
+  std::vector<std::string> channelFormats;
+  int descriptorChannels = 0;
+  int tileWidth = 0; // 0 for scanline files
+  int tileHeight = 0;
+
+  bool tiled() const { return tileWidth > 0; }
+  /* Whether the file on disk is still the one described */
+  bool upToDate(const fs::path &path) const;
+};
+
+/* Header metadata of all the EXRs under some directories, keyed by their
+ * canonical paths, stored as json */
+class Catalog {
+public:
+  Catalog() = default;
+  /* An empty catalog if the file doesn't exist yet */
+  static Catalog load(const fs::path &path);
+  void save(const fs::path &path) const;
+
+  /* Rescans the tree under root with `threads` threads (0 for all cores),
+   * reading the headers of files that are new or changed since the last
+   * scan, and forgetting the ones that are gone. Returns the number of
+   * headers read */
+  int update(const fs::path &root, int threads = 0);
+
+  /* nullptr if the file isn't in the catalog or has changed since */
+  const CatalogEntry *find(const fs::path &path) const;
+
+  const std::map<std::string, CatalogEntry> &entries() const {
+    return _entries;
+  }
+
+private:
+  std::map<std::string, CatalogEntry> _entries;
+};
+
+}; // namespace VisCor
+
+#endif
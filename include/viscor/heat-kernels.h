@@ -0,0 +1,34 @@
+#ifndef _VISCOR_HEAT_KERNELS_H
+#define _VISCOR_HEAT_KERNELS_H
+
+#include <cstdint>
+
+namespace VisCor {
+
+/* Computes heat[p] = sum_c query[c] * field[c * stride + p] for p in
+ * [begin, end), for a planar (C, H, W) float field with stride = H * W */
+using HeatKernelFn = void (*)(const float *field, int64_t stride,
+                              const float *query, int c, float *heat,
+                              int64_t begin, int64_t end);
+
+struct HeatKernel {
+  const char *name = nullptr;
+  HeatKernelFn fn = nullptr;
+
+  explicit operator bool() const { return fn != nullptr; }
+};
+
+/* The fastest kernel for this cpu, specialized for c = 64, 128 and 256 (with
+ * AVX-512 or AVX2 where available). Empty for other widths, which are left
+ * to torch's bmm */
+HeatKernel selectHeatKernel(int c);
+
+/* Maps [vmin, vmax] linearly onto lut[0..lutSize) (clamping, NaNs go to
+ * lut[0]) and writes the packed RGBA8 colours; uses AVX-512 or AVX2 gathers
+ * where available */
+void colormapRgba8(const float *src, int64_t n, float vmin, float vmax,
+                   const uint32_t *lut, int lutSize, uint32_t *dst);
+
+}; // namespace VisCor
+
+#endif
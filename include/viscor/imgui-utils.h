@@ -1,15 +1,21 @@
 #ifndef _VISCOR_IMGUI_UTILS_H
 #define _VISCOR_IMGUI_UTILS_H
 
+#include <atomic>
 #include <filesystem>
 #include <fstream>
+#include <limits>
+#include <map>
 #include <string>
+#include <tuple>
 #include <torch/torch.h>
 
 #include <imgui.h>
 #include <implot.h>
 
+#include "viscor/heat-kernels.h"
 #include "viscor/raii.h"
+#include "viscor/result-cache.h"
 #include "viscor/utils.h"
 
 namespace VisCor {
@@ -22,98 +28,352 @@ struct SliceQuery {
   int iSlice = -1;
   int jSlice = -1;
   bool exp = false;
-};
 
-inline ImPlotColormap colormapTransparentResample(ImPlotColormap src,
-                                                  int newRes, double alpha) {
-  const std::string name(std::string(ImPlot::GetColormapName(src)) + "-" +
-                         std::to_string(newRes) + "-" + std::to_string(alpha));
-  const int size = ImPlot::GetColormapSize(src);
-  std::vector<ImVec4> colors(newRes);
-  for (int i = 0; i < newRes; ++i) {
-    const auto t = i / (newRes - 1.0);
-    const auto j = t * (size - 1.0);
-    const int j0 = std::floor(j);
-    const int j1 = std::ceil(j);
-    const auto c0 = ImPlot::GetColormapColor((int)j0, src);
-    const auto c1 = ImPlot::GetColormapColor((int)j1, src);
-    if (j1 == j0) {
-      colors[i] = c0;
-    } else {
-      const auto u = j - j0;
-      const auto u1 = j1 - j;
-      colors[i] = ImVec4(u1 * c0.x + u * c1.x, u1 * c0.y + u * c1.y,
-                         u1 * c0.z + u * c1.z, u1 * c0.w + u * c1.w);
-    }
-    colors[i] = c0;
-    colors[i].w *= alpha;
-  }
-  return ImPlot::AddColormap(name.c_str(), colors.data(), newRes, false);
-}
+  bool operator==(const SliceQuery &) const = default;
+};
 
 inline double normalizeAlpha(double alpha) {
   return std::max(std::min(std::round(alpha * 100.0) / 100.0, 1.0), 0.0);
 }
 
-inline std::string alphaToString(double alpha) {
-  return std::to_string(normalizeAlpha(alpha));
-}
+/* Transparent, resampled copies of ImPlot colormaps, each (colormap, alpha,
+ * resolution) built once. ImPlot can't remove colormaps, so building one per
+ * frame or per call would grow its table without bound */
+class ColormapRegistry {
+public:
+  struct Entry {
+    ImPlotColormap id;
+    /* The same colours as packed by ImGui (RGBA8), for colormapRgba8() */
+    std::vector<uint32_t> lut;
+  };
+
+  const Entry &get(ImPlotColormap src, double alpha, int resolution = 256) {
+    alpha = normalizeAlpha(alpha);
+    const auto key =
+        std::make_tuple(src, (int)std::lround(alpha * 100), resolution);
+    if (const auto it = _entries.find(key); it != _entries.end()) {
+      return it->second;
+    }
 
-inline ImPlotColormap colormapTransparentCopy(ImPlotColormap src,
-                                              double alpha) {
-  const int size = ImPlot::GetColormapSize(src);
-  alpha = normalizeAlpha(alpha);
-  const std::string name(alphaToString(alpha) + "_" +
-                         std::string(ImPlot::GetColormapName(src)) + "_" +
-                         std::to_string(size));
-
-  {
-    const auto id = ImPlot::GetColormapIndex(name.c_str());
-    if (id != -1)
-      return id;
-  }
+    const int size = ImPlot::GetColormapSize(src);
+    std::vector<ImVec4> colors(resolution);
+    Entry entry;
+    entry.lut.resize(resolution);
+    for (int i = 0; i < resolution; ++i) {
+      const auto t = resolution > 1 ? i / (resolution - 1.0) : 0.0;
+      const auto j = t * (size - 1.0);
+      const int j0 = std::floor(j);
+      const int j1 = std::ceil(j);
+      const auto c0 = ImPlot::GetColormapColor(j0, src);
+      const auto c1 = ImPlot::GetColormapColor(j1, src);
+      const float u = j - j0;
+      const float u1 = 1 - u;
+      colors[i] = ImVec4(u1 * c0.x + u * c1.x, u1 * c0.y + u * c1.y,
+                         u1 * c0.z + u * c1.z, (u1 * c0.w + u * c1.w) * alpha);
+      entry.lut[i] = ImGui::ColorConvertFloat4ToU32(colors[i]);
+    }
 
-  std::vector<ImVec4> colors(size);
-  for (int i = 0; i < size; ++i) {
-    colors[i] = ImPlot::GetColormapColor(i, src);
-    colors[i].w *= alpha;
+    const std::string name(std::string(ImPlot::GetColormapName(src)) + "-" +
+                           std::to_string(resolution) + "-" +
+                           std::to_string(std::get<1>(key)));
+    entry.id = ImPlot::GetColormapIndex(name.c_str());
+    if (entry.id == -1) {
+      entry.id = ImPlot::AddColormap(name.c_str(), colors.data(), resolution,
+                                     false);
+    }
+    return _entries.emplace(key, std::move(entry)).first->second;
   }
 
-  const auto cmap =
-      ImPlot::AddColormap(name.c_str(), colors.data(), size, false);
-  return cmap;
-}
+private:
+  std::map<std::tuple<ImPlotColormap, int, int>, Entry> _entries;
+};
 
 struct ImHeatSlice {
-  ImHeatSlice(DescriptorField &&desc0, DescriptorField &&desc1,
-              SafeGlTexture &&image0, SafeGlTexture &&image1,
-              const torch::Device &device, const bool fix01Scale)
+  /* desc1 are compared side by side, each against the same query from
+   * desc0 */
+  ImHeatSlice(std::unique_ptr<QueryField> &&desc0, DescriptorBatch &&desc1,
+              std::vector<std::string> &&names, SafeGlTexture &&image0,
+              SafeGlTexture &&image1, const torch::Device &device,
+              const bool fix01Scale)
       : fix01Scale(fix01Scale), device(device), desc0(std::move(desc0)),
-        desc1(std::move(desc1)), image0(std::move(image0)),
-        image1(std::move(image1)) {
+        desc1(std::move(desc1.fields)), names(std::move(names)),
+        image0(std::move(image0)), image1(std::move(image1)),
+        display0(this->image0.xres(), this->image0.yres(), GL_NEAREST),
+        display1(this->image1.xres(), this->image1.yres(), GL_NEAREST) {
+    if (this->desc1.empty()) {
+      throw std::runtime_error("Expected at least one second featuremap");
+    }
+    if (this->names.size() != this->desc1.size()) {
+      throw std::runtime_error("Expected a name for every featuremap");
+    }
+    if (this->desc1.front().c() != this->desc0->c()) {
+      throw std::runtime_error("The featuremaps have different numbers of "
+                               "channels");
+    }
+    desc1Batch = std::move(desc1.data);
+    desc1BatchMemory = std::move(desc1.memory);
+
+    const auto &front = this->desc1.front();
     heat = torch::empty(
-        {desc1.h(), desc1.w()},
+        {fieldCount(), front.h(), front.w()},
         torch::TensorOptions().device(torch::kCPU).dtype(torch::kFloat32));
-    heatOnDevice = torch::zeros(
-        {desc1.h(), desc1.w()},
-        torch::TensorOptions().device(torch::kCPU).dtype(torch::kF32));
+    accountHeat();
+  }
+
+  /* heat and heatOnDevice have the same size */
+  void accountHeat() { heatMemory.resize(2 * heat.numel() * sizeof(float)); }
+
+  int fieldCount() const { return desc1.size(); }
+
+  /* Height-to-width ratio of the whole row of plots */
+  double aspect() const { return image0.aspect() / (1 + fieldCount()); }
+
+  /* Called from any thread when something the next frame depends on has
+   * changed (e.g. a result computed in the background has arrived); wakes the
+   * render loop if it's idling in glfwWaitEventsTimeout */
+  void markDirty() {
+    dirty = true;
+    glfwPostEmptyEvent();
+  }
+
+  /* Returns whether the last frame changed anything and resets the flag */
+  bool takeDirty() { return dirty.exchange(false); }
+
+  /* Switches to evaluating the query only at the given locations of desc1,
+   * whose descriptors are packed into a contiguous [N, K, C] tensor once */
+  void setKeypoints(const Keypoints &kps) {
+    if (kps.size() < 1) {
+      throw std::runtime_error("No keypoints to evaluate the query at");
+    }
+    std::vector<torch::Tensor> packed;
+    for (const auto &f : desc1) {
+      packed.push_back(kps.gather(f));
+    }
+    /* Small enough to keep in single precision even if the fields are not */
+    keypointsDesc = torch::stack(packed).to(torch::kF32);
+    keypointsMemory.resize(keypointsDesc.numel() * sizeof(float));
+    heat = torch::empty(
+        {fieldCount(), kps.size()},
+        torch::TensorOptions().device(torch::kCPU).dtype(torch::kFloat32));
+    accountHeat();
+
+    const auto &front = desc1.front();
+    const auto ij = kps.ij.to(torch::kCPU).to(torch::kFloat64);
+    keypointsY = (1.0 - (ij.select(1, 0) + .5) / front.h()).contiguous();
+    keypointsX = ((ij.select(1, 1) + .5) / front.w()).contiguous();
+
+    const auto ijCpu = kps.ij.to(torch::kCPU).contiguous();
+    keypointsHash = CacheKey("keypoints")
+                        .add(ijCpu.data_ptr(), ijCpu.numel() * sizeof(int64_t))
+                        .value();
+
+    query = SliceQuery();
+    markDirty();
+  }
+
+  bool sparse() const { return keypointsDesc.defined(); }
+
+  /* Reuses slices computed in earlier sessions; inputsHash identifies the
+   * contents of desc0 and desc1 */
+  void setResultCache(std::unique_ptr<ResultCache> &&cache,
+                      uint64_t inputsHash) {
+    resultCache = std::move(cache);
+    this->inputsHash = inputsHash;
+  }
+
+  CacheKey heatKey(const std::string &kind) const {
+    return CacheKey(kind)
+        .add(inputsHash)
+        .add(keypointsHash)
+        .add((uint64_t)desc1Batch.scalar_type())
+        .add(newQuery.iSlice)
+        .add(newQuery.jSlice)
+        .add(newQuery.exp);
+  }
+
+  bool loadHeat() {
+    double stats[2];
+    if (!resultCache->get(heatKey("heat-stats"), stats, sizeof(stats)) ||
+        !resultCache->get(heatKey("heat"), heat.data_ptr(),
+                          heat.numel() * sizeof(float))) {
+      return false;
+    }
+    heatOnDevice = heat;
+    sliceMin = stats[0];
+    sliceMax = stats[1];
+    heatStored = true;
+    return true;
+  }
+
+  void storeHeat() {
+    const double stats[] = {sliceMin, sliceMax};
+    resultCache->put(heatKey("heat"), heat.data_ptr(),
+                     heat.numel() * sizeof(float));
+    resultCache->put(heatKey("heat-stats"), stats, sizeof(stats));
+    heatStored = true;
+  }
+
+  void updateHeat() {
+    if (resultCache && loadHeat()) {
+      return;
+    }
+    computeHeat();
+    /* Only stored once the query stays put, see draw(), rather than for
+     * every intermediate position while dragging */
+    heatStored = false;
+  }
+
+  /* Evaluates the query against all of the fields at once: the query vector
+   * is gathered once and the N products run as one batched matmul, which
+   * torch spreads over all cores */
+  void computeHeat() {
+    const auto stdvar = std::sqrt(desc0->c());
+    const auto query =
+        (*desc0)(newQuery.iSlice, newQuery.jSlice).to(torch::kF32) / stdvar;
+    if (sparse()) {
+      heatOnDevice = keypointsDesc.matmul(query).div(stdvar);
+    } else {
+      const auto n = desc1Batch.size(0);
+      const auto c = desc1Batch.size(1);
+      const auto h = desc1Batch.size(2);
+      const auto w = desc1Batch.size(3);
+      const auto q = query.reshape({1, 1, c}).expand({n, 1, c});
+      if (desc1Batch.scalar_type() == torch::kF16 && desc1Batch.is_cpu()) {
+        /* There's no half-precision matmul on the cpu, and converting the
+         * whole batch would defeat the point of storing it in half; convert
+         * a few rows at a time instead */
+        heatOnDevice = torch::empty({n, h, w}, query.options());
+        const int64_t rowsPerChunk =
+            std::max<int64_t>(1, (int64_t(16) << 20) / (n * c * w));
+        for (int64_t r0 = 0; r0 < h; r0 += rowsPerChunk) {
+          const auto rows = std::min(rowsPerChunk, h - r0);
+          const auto chunk = desc1Batch.narrow(2, r0, rows)
+                                 .to(torch::kF32)
+                                 .reshape({n, c, rows * w});
+          heatOnDevice.narrow(1, r0, rows)
+              .copy_(q.bmm(chunk).reshape({n, rows, w}));
+        }
+        heatOnDevice.div_(stdvar);
+      } else if (const auto kernel = desc1.front().kernel;
+                 kernel && desc1Batch.is_cpu() &&
+                 desc1Batch.scalar_type() == torch::kF32) {
+        /* Specialized for the field's channel count, see heat-kernels.h */
+        heatOnDevice = torch::empty({n, h, w}, query.options());
+        const auto *fields = desc1Batch.data_ptr<float>();
+        const auto queryCpu = query.contiguous();
+        const auto *queryPtr = queryCpu.data_ptr<float>();
+        auto *heats = heatOnDevice.data_ptr<float>();
+        at::parallel_for(0, h * w, 1 << 14, [&](int64_t begin, int64_t end) {
+          for (int64_t i = 0; i < n; ++i) {
+            kernel.fn(fields + i * c * h * w, h * w, queryPtr, c,
+                      heats + i * h * w, begin, end);
+          }
+        });
+        heatOnDevice.div_(stdvar);
+      } else {
+        heatOnDevice = q.to(desc1Batch.scalar_type())
+                           .bmm(desc1Batch.reshape({n, c, h * w}))
+                           .to(torch::kF32)
+                           .div(stdvar)
+                           .reshape({n, h, w});
+      }
+    }
+    if (newQuery.exp) {
+      heatOnDevice.exp_();
+    }
+    // ImPlot color interpolation crashes whenever it sees NaNs or
+    // infinities
+    const auto max = 1e30; // std::numeric_limits<float>::quiet_NaN();
+    heatOnDevice.nan_to_num_(max, max, -max);
+    heatOnDevice.clip_(-max, max);
+
+    heat.copy_(heatOnDevice.to(torch::kCPU));
+    sliceMin = heatOnDevice.min().item<double>();
+    sliceMax = heatOnDevice.max().item<double>();
+  }
+
+  /* Draws the keypoints as a scatter, each coloured by its heat in field n */
+  void plotKeypoints(int n, const ColormapRegistry::Entry &cmap) {
+    constexpr float radius = 3;
+    const auto count = heat.size(1);
+    const auto *x = keypointsX.data_ptr<double>();
+    const auto *y = keypointsY.data_ptr<double>();
+
+    keypointColors.resize(count);
+    colormapRgba8(heat.select(0, n).data_ptr<float>(), count, heatMin, heatMax,
+                  cmap.lut.data(), cmap.lut.size(), keypointColors.data());
+
+    auto *drawList = ImPlot::GetPlotDrawList();
+    ImPlot::PushPlotClipRect();
+    for (int k = 0; k < count; ++k) {
+      drawList->AddCircleFilled(ImPlot::PlotToPixels(x[k], y[k]), radius,
+                                keypointColors[k]);
+    }
+    ImPlot::PopPlotClipRect();
+  }
+
+  /* Writes each field's current slice as an opaque colormapped PNG into dir,
+   * returning the paths written */
+  std::vector<fs::path> exportHeatmaps(const fs::path &dir) {
+    using namespace OIIO;
+    std::vector<fs::path> paths;
+    if (sparse()) {
+      return paths;
+    }
+
+    const auto &cmap = colormaps.get(ImPlotColormap_Viridis, 1.0);
+    const int h = heat.size(1);
+    const int w = heat.size(2);
+    std::vector<uint32_t> rgba((size_t)h * w);
+    for (int n = 0; n < fieldCount(); ++n) {
+      colormapRgba8(heat.select(0, n).data_ptr<float>(), rgba.size(), heatMin,
+                    heatMax, cmap.lut.data(), cmap.lut.size(), rgba.data());
+
+      const auto path =
+          dir / ("heat" + std::to_string(n) + "_" +
+                 std::to_string(query.iSlice) + "_" +
+                 std::to_string(query.jSlice) + ".png");
+      const ImageSpec spec(w, h, 4, TypeDesc::UINT8);
+      auto out = ImageOutput::create(path.string());
+      if (!out || !out->open(path.string(), spec) ||
+          !out->write_image(TypeDesc::UINT8, rgba.data())) {
+        throw std::runtime_error("Couldn't write " + path.string());
+      }
+      out->close();
+      paths.push_back(path);
+    }
+    return paths;
+  }
+
+  /* Re-renders the displayed images if exposure or gamma have changed; this
+   * only runs a shader, the images aren't converted or uploaded again */
+  void updateDisplayImages() {
+    if (exposure == displayedExposure && gamma == displayedGamma) {
+      return;
+    }
+    toneMapper.apply(image0, display0, exposure, gamma);
+    toneMapper.apply(image1, display1, exposure, gamma);
+    displayedExposure = exposure;
+    displayedGamma = gamma;
+    dirty = true;
   }
 
   bool draw() {
     using namespace ImPlot;
 
+    updateDisplayImages();
+
     constexpr auto defaultPlotOptions =
         ImPlotFlags_NoLegend | ImPlotFlags_AntiAliased | ImPlotFlags_Crosshairs;
 
     const auto frameSize = ImGui::GetWindowSize();
     const auto cmapWidth = 100;
-    const auto plotSize =
-        ImVec2(.5 * (frameSize.x - cmapWidth),
-               .5 * (frameSize.x - cmapWidth) * image0.aspect());
+    const auto plotWidth = (frameSize.x - cmapWidth) / (1 + fieldCount());
+    const auto plotSize = ImVec2(plotWidth, plotWidth * image0.aspect());
 
     if (ImPlot::BeginPlot("Image0", nullptr, nullptr, plotSize,
                           defaultPlotOptions)) {
-      ImPlot::PlotImage("im0", image0.textureVoidStar(), ImPlotPoint(0.0, 0.0),
+      ImPlot::PlotImage("im0", display0.textureVoidStar(), ImPlotPoint(0.0, 0.0),
                         ImPlotPoint(1.0, 1.0));
 
       const auto xyNew = ImPlot::GetPlotMousePos();
@@ -137,64 +397,68 @@ struct ImHeatSlice {
       newQuery.v0 = uv.y;
 
       const auto i =
-          std::max(0, std::min((int)(uv.y * desc0.h()), desc0.h() - 1));
+          std::max(0, std::min((int)(uv.y * desc0->h()), desc0->h() - 1));
       const auto j =
-          std::max(0, std::min((int)(uv.x * desc0.w()), desc0.w() - 1));
+          std::max(0, std::min((int)(uv.x * desc0->w()), desc0->w() - 1));
       newQuery.iSlice = i;
       newQuery.jSlice = j;
 
       ImPlot::EndPlot();
     }
 
-    ImGui::SameLine();
+    bool cachedSlice = newQuery.exp == query.exp &&
+                       newQuery.iSlice == query.iSlice &&
+                       newQuery.jSlice == query.jSlice &&
+                       heatOnDevice.defined();
 
-    if (ImPlot::BeginPlot("Image1", nullptr, nullptr, plotSize,
-                          ImPlotFlags_NoLegend | ImPlotFlags_AntiAliased |
-                              ImPlotFlags_Crosshairs)) {
-      bool cachedSlice = newQuery.exp == query.exp &&
-                         newQuery.iSlice == query.iSlice &&
-                         newQuery.jSlice == query.jSlice && heat.size(0) > 0 &&
-                         heat.size(1) > 0;
-
-      if (!cachedSlice) {
-        const auto stdvar = std::sqrt(desc1.c());
-        const auto query =
-            desc0(newQuery.iSlice, newQuery.jSlice).reshape({desc0.c(), 1, 1}) /
-            stdvar;
-        heatOnDevice = desc1.data.div(stdvar).mul(query).sum(0);
-        if (newQuery.exp) {
-          heatOnDevice.exp_();
-        }
-        // ImPlot color interpolation crashes whenever it sees NaNs or
-        // infinities
-        const auto max = 1e30; // std::numeric_limits<float>::quiet_NaN();
-        heatOnDevice.nan_to_num_(max, max, -max);
-        heatOnDevice.clip_(-max, max);
-
-        heat.copy_(heatOnDevice.to(torch::kCPU));
-      }
-
-      if (fix01Scale) {
-        heatMin = 0;
-        heatMax = 1;
-      } else {
-        heatMin = heatOnDevice.min().item<double>();
-        heatMax = heatOnDevice.max().item<double>();
-      }
+    if (!cachedSlice) {
+      updateHeat();
+    } else if (resultCache && !heatStored) {
+      storeHeat();
+    }
 
-      heatMax = std::max(heatMax, heatMin + .1);
+    /* The scale is shared by all of the fields so that they're comparable */
+    if (fix01Scale) {
+      heatMin = 0;
+      heatMax = 1;
+    } else {
+      heatMin = sliceMin;
+      heatMax = sliceMax;
+    }
 
-      ImPlot::PlotImage("im1", image1.textureVoidStar(), ImPlotPoint(0.0, 0.0),
-                        ImPlotPoint(1.0, 1.0));
+    heatMax = std::max(heatMax, heatMin + .1);
 
-      const auto cmap = colormapTransparentCopy(ImPlotColormap_Viridis, alpha);
-      ImPlot::PushColormap(cmap);
-      ImPlot::PlotHeatmap("Correspondence volume slice",
-                          (float *)heat.data_ptr(), heat.size(0), heat.size(1),
-                          heatMin, heatMax, nullptr);
-      ImPlot::PopColormap();
+    if (!cachedSlice || alpha != drawnAlpha || heatMin != drawnHeatMin ||
+        heatMax != drawnHeatMax) {
+      dirty = true;
+    }
+    drawnAlpha = alpha;
+    drawnHeatMin = heatMin;
+    drawnHeatMax = heatMax;
+
+    const auto &cmap = colormaps.get(ImPlotColormap_Viridis, alpha);
+    for (int n = 0; n < fieldCount(); ++n) {
+      ImGui::SameLine();
+
+      const auto title = names[n] + "##Image1-" + std::to_string(n);
+      if (ImPlot::BeginPlot(title.c_str(), nullptr, nullptr, plotSize,
+                            defaultPlotOptions)) {
+        ImPlot::PlotImage("im1", display1.textureVoidStar(),
+                          ImPlotPoint(0.0, 0.0), ImPlotPoint(1.0, 1.0));
+
+        if (sparse()) {
+          plotKeypoints(n, cmap);
+        } else {
+          const auto slice = heat.select(0, n);
+          ImPlot::PushColormap(cmap.id);
+          ImPlot::PlotHeatmap("Correspondence volume slice",
+                              slice.data_ptr<float>(), slice.size(0),
+                              slice.size(1), heatMin, heatMax, nullptr);
+          ImPlot::PopColormap();
+        }
 
-      ImPlot::EndPlot();
+        ImPlot::EndPlot();
+      }
     }
 
     ImPlot::PushColormap(ImPlotColormap_Viridis);
@@ -203,6 +467,9 @@ struct ImHeatSlice {
                           ImVec2(cmapWidth, plotSize.y));
     ImPlot::PopColormap();
 
+    if (newQuery != query) {
+      dirty = true;
+    }
     query = newQuery;
 
     return true;
@@ -212,15 +479,46 @@ struct ImHeatSlice {
   SliceQuery query;
   bool fix01Scale = false;
   float alpha = .75;
+  float exposure = 0; // stops
+  float gamma = 2.2;
   double heatMin = 0;
   double heatMax = 1;
+  /* Range of the current slice over all of the fields */
+  double sliceMin = 0;
+  double sliceMax = 1;
+  /* What the last frame has been drawn with, so that draw() can tell whether
+   * anything has changed */
+  float drawnAlpha = -1;
+  double drawnHeatMin = 0;
+  double drawnHeatMax = 0;
+  float displayedExposure = std::numeric_limits<float>::quiet_NaN();
+  float displayedGamma = std::numeric_limits<float>::quiet_NaN();
+  std::atomic<bool> dirty = true;
   torch::Device device;
-  DescriptorField desc0;
-  DescriptorField desc1;
-  SafeGlTexture image0;
+  std::unique_ptr<QueryField> desc0;
+  std::vector<DescriptorField> desc1;
+  std::vector<std::string> names;
+  SafeGlTexture image0; // as loaded, possibly half-float
   SafeGlTexture image1;
-  torch::Tensor heat;
+  SafeGlTexture display0; // tone mapped RGBA8
+  SafeGlTexture display1;
+  ToneMapper toneMapper;
+  torch::Tensor desc1Batch; // [N, C, H, W], desc1 are views into it
+  MemoryLease desc1BatchMemory;
+  torch::Tensor heat;         // [N, H, W], or [N, K] in the sparse mode
   torch::Tensor heatOnDevice;
+  MemoryLease heatMemory{"Heat", "heat", 0};
+  std::unique_ptr<ResultCache> resultCache;
+  uint64_t inputsHash = 0;
+  uint64_t keypointsHash = 0;
+  bool heatStored = true;
+  MemoryLease keypointsMemory{"Descriptors", "keypoints", 0};
+  /* Only defined in the sparse (keypoint) mode */
+  torch::Tensor keypointsDesc; // [N, K, C]
+  torch::Tensor keypointsX;
+  torch::Tensor keypointsY;
+  std::vector<uint32_t> keypointColors;
+  ColormapRegistry colormaps;
 };
 
 }; // namespace VisCor
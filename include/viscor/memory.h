@@ -0,0 +1,73 @@
+#ifndef _VISCOR_MEMORY_H
+#define _VISCOR_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace VisCor {
+
+/* Keeps count of how much the big allocations (descriptor fields, heat
+ * buffers, textures, caches) take, and of how much they're allowed to */
+class MemoryRegistry {
+public:
+  struct Entry {
+    std::string category;
+    std::string name;
+    size_t bytes;
+  };
+
+  static MemoryRegistry &instance();
+
+  /* 0 means unlimited */
+  void setBudget(size_t bytes);
+  size_t budget() const;
+
+  size_t used() const;
+  /* How much more fits in the budget */
+  size_t available() const;
+  bool fits(size_t bytes) const { return bytes <= available(); }
+
+  std::vector<Entry> breakdown() const;
+
+private:
+  friend class MemoryLease;
+
+  size_t add(const std::string &category, const std::string &name,
+             size_t bytes);
+  void resize(size_t id, size_t bytes);
+  void remove(size_t id);
+
+  mutable std::mutex _mutex;
+  size_t _budget = 0;
+  size_t _used = 0;
+  size_t _nextId = 1;
+  std::map<size_t, Entry> _entries;
+};
+
+/* Accounts `bytes` to the registry for as long as it's alive; owners of big
+ * buffers keep one next to the buffer */
+class MemoryLease {
+public:
+  MemoryLease() = default;
+  MemoryLease(const std::string &category, const std::string &name,
+              size_t bytes);
+  ~MemoryLease();
+
+  MemoryLease(MemoryLease &&other);
+  MemoryLease &operator=(MemoryLease &&other);
+  MemoryLease(const MemoryLease &) = delete;
+  MemoryLease &operator=(const MemoryLease &) = delete;
+
+  void resize(size_t bytes);
+
+private:
+  size_t _id = 0;
+};
+
+}; // namespace VisCor
+
+#endif
@@ -9,6 +9,7 @@
 #include <imgui_impl_opengl3.h>
 #include <implot.h>
 
+#include "viscor/memory.h"
 #include "viscor/utils.h"
 
 namespace VisCor {
@@ -32,7 +33,7 @@ public:
 
 class SafeGlfwWindow : NoCopy {
 public:
-  SafeGlfwWindow();
+  SafeGlfwWindow(bool visible = true);
   ~SafeGlfwWindow();
 
   GLFWwindow *window() const;
@@ -142,11 +143,17 @@ public:
 
 class SafeGlTexture : NoCopy {
 public:
-  SafeGlTexture(const Uint8Image &image,
+  /* Uploaded as a half-float texture, no quantization */
+  SafeGlTexture(const HalfImage &image,
+                const unsigned int interpolation = GL_LINEAR);
+  /* Uninitialized RGBA8, e.g. to render into */
+  SafeGlTexture(int xres, int yres,
                 const unsigned int interpolation = GL_LINEAR);
 
   SafeGlTexture(SafeGlTexture &&other)
-      : _texture(other._texture), _xres(other._xres), _yres(other._yres) {
+      : _texture(other._texture), _xres(other._xres), _yres(other._yres),
+        _channels(other._channels), _linear(other._linear),
+        _memory(std::move(other._memory)) {
     other._texture = GL_INVALID_VALUE;
   }
 
@@ -158,10 +165,44 @@ public:
   int xres() const { return _xres; }
   int yres() const { return _yres; }
   double aspect() const { return _yres * 1.0 / _xres; }
+  int channels() const { return _channels; }
+  bool linear() const { return _linear; }
 
 private:
+  void create(const unsigned int interpolation);
+
   GLuint _texture;
   int _xres, _yres;
+  int _channels = 4;
+  bool _linear = false;
+  MemoryLease _memory;
+};
+
+class SafeFramebuffer : NoCopy {
+public:
+  SafeFramebuffer() { glGenFramebuffers(1, &_fbo); }
+  ~SafeFramebuffer() { glDeleteFramebuffers(1, &_fbo); }
+
+  GLuint fbo() const { return _fbo; }
+
+private:
+  GLuint _fbo;
+};
+
+/* Renders a (half-float) texture into an RGBA8 one with exposure and gamma
+ * applied, entirely on the GPU */
+class ToneMapper : NoCopy {
+public:
+  ToneMapper();
+
+  /* exposure is in stops, gamma is the display gamma */
+  void apply(const SafeGlTexture &src, const SafeGlTexture &dst,
+             float exposure, float gamma);
+
+private:
+  VtxFragProgram _program;
+  SafeVAO _vao;
+  SafeFramebuffer _fbo;
 };
 }; // namespace VisCor
 
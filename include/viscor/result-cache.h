@@ -0,0 +1,68 @@
+#ifndef _VISCOR_RESULT_CACHE_H
+#define _VISCOR_RESULT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+
+namespace VisCor {
+
+namespace fs = std::filesystem;
+
+/* 64-bit hash of a file's contents (xxhash64-style, reads the whole file) */
+uint64_t hashFileContents(const fs::path &path);
+
+/* Identifies an artifact: the hashes of its inputs plus its parameters */
+class CacheKey {
+public:
+  explicit CacheKey(const std::string &kind);
+
+  CacheKey &add(uint64_t part);
+  CacheKey &add(const void *data, size_t bytes);
+
+  uint64_t value() const { return _hash; }
+  std::string hex() const;
+
+private:
+  uint64_t _hash;
+};
+
+/* A directory of computed artifacts that outlives the process. Each artifact
+ * is a small header followed by the raw bytes, so it can also be mmap'd.
+ * Once the directory grows past maxBytes the least recently used artifacts
+ * are evicted */
+class ResultCache {
+public:
+  ResultCache(const fs::path &dir, size_t maxBytes);
+
+  /* hashFileContents(), remembered in the cache for as long as the file's
+   * size and mtime don't change */
+  uint64_t fileHash(const fs::path &path);
+
+  /* Cheap stand-in for fileHash() on files too large to read up front:
+   * hashes the canonical path, size, mtime and the first prefixBytes bytes
+   * (the EXR header). A file rewritten in place with the same size and mtime
+   * keeps its identity */
+  static uint64_t fileIdentity(const fs::path &path,
+                               size_t prefixBytes = 1 << 16);
+
+  /* Reads the artifact into data if it exists, has exactly `bytes` bytes and
+   * matches its checksum. Neither get nor put throws: failures are misses */
+  bool get(const CacheKey &key, void *data, size_t bytes);
+  void put(const CacheKey &key, const void *data, size_t bytes);
+
+private:
+  fs::path artifactPath(const CacheKey &key) const;
+  void evict();
+
+  fs::path _dir;
+  size_t _maxBytes;
+  size_t _usedBytes = 0;
+  std::mutex _mutex;
+};
+
+}; // namespace VisCor
+
+#endif
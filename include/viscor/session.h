@@ -0,0 +1,87 @@
+#ifndef _VISCOR_SESSION_H
+#define _VISCOR_SESSION_H
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "viscor/imgui-utils.h"
+#include "viscor/raii.h"
+
+namespace VisCor {
+
+namespace fs = std::filesystem;
+
+/* One state of the viewer in a recorded session: the query and the toolbox
+ * settings, as they were t seconds after the recording started */
+struct SessionEvent {
+  double t = 0;
+  SliceQuery query;
+  float alpha = .75;
+  float exposure = 0;
+  float gamma = 2.2;
+};
+
+/* Appends an event (as a line of json) every time the query or the settings
+ * change */
+class SessionRecorder : NoCopy {
+public:
+  SessionRecorder(const fs::path &path);
+
+  void record(const SliceQuery &query, float alpha, float exposure,
+              float gamma);
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  std::ofstream _out;
+  clock::time_point _start;
+  std::optional<SessionEvent> _last;
+};
+
+struct LatencyReport {
+  int events = 0;
+  int presented = 0;
+  /* Events superseded by a later one before they made it to the screen */
+  int dropped = 0;
+  /* Presented events that took longer than the frame budget */
+  int late = 0;
+  double p50 = 0, p90 = 0, p99 = 0, max = 0; // milliseconds
+
+  std::string json() const;
+};
+
+/* Feeds a recorded session back into an ImHeatSlice in real time and
+ * measures, for every event, the time from when it was due to when the frame
+ * showing it has been presented */
+class SessionReplay : NoCopy {
+public:
+  SessionReplay(const fs::path &path, double frameBudgetMs = 1000.0 / 60.0);
+
+  /* Applies the events due by now; call before building a frame */
+  void apply(ImHeatSlice &view);
+  /* Call once the frame is on screen, i.e. after swapping and glFinish() */
+  void presented();
+  bool done() const;
+
+  LatencyReport report() const;
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  std::vector<SessionEvent> _events;
+  size_t _next = 0;
+  std::optional<clock::time_point> _start;
+  /* When the event shown by the frame being built was due */
+  std::optional<clock::time_point> _pending;
+  std::vector<double> _latencies;
+  int _dropped = 0;
+  double _frameBudgetMs;
+};
+
+}; // namespace VisCor
+
+#endif
@@ -1,52 +1,156 @@
 #ifndef _VISCOR_UTILS_H
 #define _VISCOR_UTILS_H
 
+#include <OpenImageIO/imagecache.h>
 #include <filesystem>
 #include <fstream>
 #include <nlohmann/json.hpp>
 #include <string>
 #include <torch/torch.h>
 
+#include "viscor/heat-kernels.h"
+#include "viscor/memory.h"
+
 namespace VisCor {
 
 namespace fs = std::filesystem;
 
-struct DescriptorField {
+/* A field we only ever read one pixel's descriptor at a time from */
+struct QueryField {
+  virtual ~QueryField() = default;
+
+  virtual torch::Tensor operator()(const int i, const int j) const = 0;
+
+  virtual int h() const = 0;
+  virtual int w() const = 0;
+  virtual int c() const = 0;
+};
+
+struct DescriptorField : QueryField {
   std::tuple<int, int, int> shape;
   torch::Tensor data;
+  MemoryLease memory;
+  /* Set for single precision fields on the cpu */
+  HeatKernel kernel;
 
   DescriptorField(const DescriptorField &) = delete;
   DescriptorField() = default;
   DescriptorField(DescriptorField &&) = default;
 
-  torch::Tensor operator()(const int i, const int j) const {
+  torch::Tensor operator()(const int i, const int j) const override {
     using namespace torch::indexing;
     return data.index({Slice(), i, j});
   }
 
-  int h() const { return std::get<0>(shape); }
-  int w() const { return std::get<1>(shape); }
-  int c() const { return std::get<2>(shape); }
+  int h() const override { return std::get<0>(shape); }
+  int w() const override { return std::get<1>(shape); }
+  int c() const override { return std::get<2>(shape); }
+};
+
+/* (h, w, c) of the descriptor in an EXR, from its header. Here and below,
+ * scoreChannel is left out of the descriptor (see descriptorChannels) */
+std::tuple<int, int, int> exrFieldShape(const fs::path &path,
+                                        const std::string &scoreChannel = "");
+
+/* Throws if the field doesn't fit in the memory budget (see MemoryRegistry)
+ * at the given precision */
+DescriptorField loadExrField(const fs::path &path, const torch::Device &device,
+                             torch::ScalarType dtype = torch::kF32,
+                             const std::string &scoreChannel = "");
+
+/* One precision for fields that are compared together: single if all of
+ * them fit in the memory budget, else half if that does; throws otherwise.
+ * Sizes come from the headers, nothing is loaded */
+torch::ScalarType fieldsPrecision(const std::vector<std::string> &paths,
+                                  const std::string &scoreChannel = "");
+
+/* Fields of the same shape read straight into one [N, C, H, W] tensor, so
+ * that a query is a single batched product against all of them. Each field's
+ * data is a view of its slice, and the batch holds the lease for all of them */
+struct DescriptorBatch {
+  torch::Tensor data;
+  MemoryLease memory;
+  std::vector<DescriptorField> fields;
 };
 
-DescriptorField loadExrField(const fs::path &path, const torch::Device &device);
+/* Loads at fieldsPrecision(paths); only the batch is ever allocated */
+DescriptorBatch loadExrFieldBatch(const std::vector<std::string> &paths,
+                                  const torch::Device &device,
+                                  const std::string &scoreChannel = "");
+
+/* Reads the descriptors straight from the EXR on demand, through an
+ * ImageCache which keeps the touched tiles (files stored as scanlines are
+ * cached in autotile-sized chunks), so nothing is loaded up front */
+class LazyExrField : public QueryField {
+public:
+  LazyExrField(const fs::path &path, const torch::Device &device,
+               float cacheMB = 64, const std::string &scoreChannel = "");
+  ~LazyExrField();
+
+  LazyExrField(const LazyExrField &) = delete;
+  LazyExrField &operator=(const LazyExrField &) = delete;
+
+  torch::Tensor operator()(const int i, const int j) const override;
+
+  int h() const override { return std::get<0>(_shape); }
+  int w() const override { return std::get<1>(_shape); }
+  int c() const override { return std::get<2>(_shape); }
+
+private:
+  OIIO::ustring _path;
+  OIIO::ImageCache *_cache;
+  torch::Device _device;
+  std::tuple<int, int, int> _shape;
+  int _x0, _y0;           // origin of the data window
+  int _chBegin, _chEnd;   // range of channels spanning the descriptor
+  torch::Tensor _chIndex; // descriptor channels, relative to _chBegin
+  MemoryLease _memory;
+};
+
+/* A sparse set of locations in a DescriptorField's grid, e.g. the keypoints
+ * a detector has fired on */
+struct Keypoints {
+  torch::Tensor ij; // [K, 2], int64, (row, column)
+
+  int size() const { return ij.size(0); }
+  torch::Tensor i() const { return ij.select(1, 0); }
+  torch::Tensor j() const { return ij.select(1, 1); }
+
+  /* The descriptors at the keypoints, packed contiguously as [K, C] */
+  torch::Tensor gather(const DescriptorField &field) const;
+};
+
+/* Reads {"keypoints": [[x, y], ...]} with x, y in pixels of the field's grid */
+Keypoints loadKeypointsJson(const fs::path &path, int h, int w);
+
+/* Picks up to maxCount locations with the highest values in the `channel` of
+ * the EXR at `path`, ignoring those not exceeding `threshold` */
+Keypoints keypointsFromScoreChannel(const fs::path &path,
+                                    const std::string &channel,
+                                    double threshold, int maxCount);
 
-struct Uint8Image {
+/* An image kept at (up to) half-float precision, e.g. a 16-bit TIFF or an EXR
+ * render; data holds the raw IEEE 754 half bits */
+struct HalfImage {
   int xres;
   int yres;
   int channels;
-  std::unique_ptr<unsigned char[]> data;
+  /* Whether the values are linear (as in EXRs), as opposed to sRGB-encoded */
+  bool linear;
+  std::unique_ptr<uint16_t[]> data;
 
-  Uint8Image(int xres, int yres, int channels,
-             std::unique_ptr<unsigned char[]> &&data)
-      : xres(xres), yres(yres), channels(channels), data(std::move(data)) {}
+  HalfImage(int xres, int yres, int channels, bool linear,
+            std::unique_ptr<uint16_t[]> &&data)
+      : xres(xres), yres(yres), channels(channels), linear(linear),
+        data(std::move(data)) {}
 
-  Uint8Image(Uint8Image &&other)
-      : xres(other.xres), yres(other.yres), data(std::move(other.data)) {}
-  Uint8Image(const Uint8Image &other) = delete;
+  HalfImage(HalfImage &&other) = default;
+  HalfImage(const HalfImage &other) = delete;
 };
 
-Uint8Image oiioLoadImage(const std::string &filename);
+/* Decodes at native precision (converted to half) using `threads` threads,
+ * 0 meaning all cores */
+HalfImage oiioLoadImageHalf(const std::string &filename, int threads = 0);
 
 struct LayoutJson {
   LayoutJson(const fs::path &path) {
@@ -0,0 +1,92 @@
+#include "viscor/memory.h"
+
+using namespace VisCor;
+
+MemoryRegistry &VisCor::MemoryRegistry::instance() {
+  static MemoryRegistry registry;
+  return registry;
+}
+
+void VisCor::MemoryRegistry::setBudget(size_t bytes) {
+  std::lock_guard lock(_mutex);
+  _budget = bytes;
+}
+
+size_t VisCor::MemoryRegistry::budget() const {
+  std::lock_guard lock(_mutex);
+  return _budget;
+}
+
+size_t VisCor::MemoryRegistry::used() const {
+  std::lock_guard lock(_mutex);
+  return _used;
+}
+
+size_t VisCor::MemoryRegistry::available() const {
+  std::lock_guard lock(_mutex);
+  if (_budget == 0)
+    return SIZE_MAX;
+  return _budget > _used ? _budget - _used : 0;
+}
+
+std::vector<MemoryRegistry::Entry> VisCor::MemoryRegistry::breakdown() const {
+  std::lock_guard lock(_mutex);
+  std::vector<Entry> entries;
+  for (const auto &[id, e] : _entries) {
+    entries.push_back(e);
+  }
+  return entries;
+}
+
+size_t VisCor::MemoryRegistry::add(const std::string &category,
+                                   const std::string &name, size_t bytes) {
+  std::lock_guard lock(_mutex);
+  const auto id = _nextId++;
+  _entries.emplace(id, Entry{category, name, bytes});
+  _used += bytes;
+  return id;
+}
+
+void VisCor::MemoryRegistry::resize(size_t id, size_t bytes) {
+  std::lock_guard lock(_mutex);
+  auto &e = _entries.at(id);
+  _used = _used - e.bytes + bytes;
+  e.bytes = bytes;
+}
+
+void VisCor::MemoryRegistry::remove(size_t id) {
+  std::lock_guard lock(_mutex);
+  const auto it = _entries.find(id);
+  if (it == _entries.end())
+    return;
+  _used -= it->second.bytes;
+  _entries.erase(it);
+}
+
+VisCor::MemoryLease::MemoryLease(const std::string &category,
+                                 const std::string &name, size_t bytes)
+    : _id(MemoryRegistry::instance().add(category, name, bytes)) {}
+
+VisCor::MemoryLease::~MemoryLease() {
+  if (_id != 0)
+    MemoryRegistry::instance().remove(_id);
+}
+
+VisCor::MemoryLease::MemoryLease(MemoryLease &&other) : _id(other._id) {
+  other._id = 0;
+}
+
+MemoryLease &VisCor::MemoryLease::operator=(MemoryLease &&other) {
+  if (this != &other) {
+    if (_id != 0)
+      MemoryRegistry::instance().remove(_id);
+    _id = other._id;
+    other._id = 0;
+  }
+  return *this;
+}
+
+void VisCor::MemoryLease::resize(size_t bytes) {
+  if (_id != 0)
+    MemoryRegistry::instance().resize(_id, bytes);
+}
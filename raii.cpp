@@ -2,10 +2,11 @@
 
 using namespace VisCor;
 
-VisCor::SafeGlfwWindow::SafeGlfwWindow() {
+VisCor::SafeGlfwWindow::SafeGlfwWindow(bool visible) {
   const auto width = WINDOW_MIN_WIDTH;
   const auto height = WINDOW_MIN_WIDTH * (9.0 / 16.0) * .5;
   glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
+  glfwWindowHint(GLFW_VISIBLE, visible ? GL_TRUE : GL_FALSE);
   /* will make'em params later */
   const char title[] = "check out nix-meson-glfw";
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -87,6 +88,14 @@ VisCor::VtxFragProgram::VtxFragProgram(const char *vtxShader,
       _fragShader(GL_FRAGMENT_SHADER, fragShader) {
   glAttachShader(_program.program(), _vtxShader.shader());
   glAttachShader(_program.program(), _fragShader.shader());
+  glLinkProgram(_program.program());
+
+  GLint linkStatus;
+  glGetProgramiv(_program.program(), GL_LINK_STATUS, &linkStatus);
+
+  if (linkStatus != GL_TRUE) {
+    throw std::runtime_error("Shader program linking failed");
+  }
 }
 GLuint VisCor::VtxFragProgram::vtxShader() const { return _vtxShader.shader(); }
 GLuint VisCor::VtxFragProgram::fragShader() const {
@@ -121,9 +130,7 @@ VisCor::ImGuiGlfwFrame::~ImGuiGlfwFrame() {
   ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
-VisCor::SafeGlTexture::SafeGlTexture(const Uint8Image &image,
-                                     const unsigned int interpolation)
-    : _texture(0), _xres(image.xres), _yres(image.yres) {
+void VisCor::SafeGlTexture::create(const unsigned int interpolation) {
   glGenTextures(1, &_texture);
   glBindTexture(GL_TEXTURE_2D, _texture);
 
@@ -131,14 +138,121 @@ VisCor::SafeGlTexture::SafeGlTexture(const Uint8Image &image,
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, interpolation);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+VisCor::SafeGlTexture::SafeGlTexture(const HalfImage &image,
+                                     const unsigned int interpolation)
+    : _texture(0), _xres(image.xres), _yres(image.yres),
+      _channels(image.channels), _linear(image.linear),
+      _memory("Textures", "half-float texture",
+              (size_t)_xres * _yres * _channels * 2) {
+  create(interpolation);
+
+  constexpr unsigned int internalFormats[] = {0, GL_R16F, GL_RG16F, GL_RGB16F,
+                                              GL_RGBA16F};
+  constexpr unsigned int formats[] = {0, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+  /* Rows of 1- and 3-channel half images needn't be 4-byte aligned */
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[image.channels], _xres, _yres,
+               0, formats[image.channels], GL_HALF_FLOAT, image.data.get());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
 
-  constexpr unsigned int modes[] = {0, GL_DEPTH_COMPONENT, 0, GL_RGB, GL_RGBA};
-  const auto mode = modes[image.channels];
-  glTexImage2D(GL_TEXTURE_2D, 0, mode, _xres, _yres, 0, mode, GL_UNSIGNED_BYTE,
-               image.data.get());
+VisCor::SafeGlTexture::SafeGlTexture(int xres, int yres,
+                                     const unsigned int interpolation)
+    : _texture(0), _xres(xres), _yres(yres),
+      _memory("Textures", "RGBA8 render target", (size_t)_xres * _yres * 4) {
+  create(interpolation);
+
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, _xres, _yres, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, nullptr);
 }
 VisCor::SafeGlTexture::~SafeGlTexture() {
   if (_texture != GL_INVALID_VALUE) {
     glDeleteTextures(1, &_texture);
   }
 }
+
+namespace {
+const char toneMapVtx[] = R"(#version 150
+out vec2 uv;
+void main() {
+  /* A single triangle covering the whole viewport */
+  uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+const char toneMapFrag[] = R"(#version 150
+uniform sampler2D image;
+uniform int channels;
+uniform bool linear;
+uniform float exposure;
+uniform float gamma;
+in vec2 uv;
+out vec4 color;
+void main() {
+  vec4 c = texture(image, uv);
+  if (channels < 3) {
+    c = vec4(c.rrr, channels == 2 ? c.g : 1.0);
+  } else if (channels == 3) {
+    c.a = 1.0;
+  }
+  vec3 rgb = max(c.rgb, 0.0);
+  if (!linear) {
+    rgb = pow(rgb, vec3(2.2));
+  }
+  rgb *= exp2(exposure);
+  rgb = pow(clamp(rgb, 0.0, 1.0), vec3(1.0 / gamma));
+  color = vec4(rgb, c.a);
+}
+)";
+} // namespace
+
+VisCor::ToneMapper::ToneMapper() : _program(toneMapVtx, toneMapFrag) {}
+
+void VisCor::ToneMapper::apply(const SafeGlTexture &src,
+                               const SafeGlTexture &dst, float exposure,
+                               float gamma) {
+  /* We run in the middle of building an ImGui frame, so leave the state as we
+   * found it */
+  GLint lastFbo, lastProgram, lastVao, lastTexture, lastViewport[4];
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &lastFbo);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &lastProgram);
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &lastVao);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &lastTexture);
+  glGetIntegerv(GL_VIEWPORT, lastViewport);
+  const GLboolean lastBlend = glIsEnabled(GL_BLEND);
+  const GLboolean lastScissor = glIsEnabled(GL_SCISSOR_TEST);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, _fbo.fbo());
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         dst.texture(), 0);
+  glViewport(0, 0, dst.xres(), dst.yres());
+  glDisable(GL_BLEND);
+  glDisable(GL_SCISSOR_TEST);
+
+  const auto program = _program.program();
+  glUseProgram(program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, src.texture());
+  glUniform1i(glGetUniformLocation(program, "image"), 0);
+  glUniform1i(glGetUniformLocation(program, "channels"), src.channels());
+  glUniform1i(glGetUniformLocation(program, "linear"), src.linear());
+  glUniform1f(glGetUniformLocation(program, "exposure"), exposure);
+  glUniform1f(glGetUniformLocation(program, "gamma"), gamma);
+
+  _vao.bind();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, lastFbo);
+  glUseProgram(lastProgram);
+  glBindVertexArray(lastVao);
+  glBindTexture(GL_TEXTURE_2D, lastTexture);
+  glViewport(lastViewport[0], lastViewport[1], lastViewport[2],
+             lastViewport[3]);
+  if (lastBlend)
+    glEnable(GL_BLEND);
+  if (lastScissor)
+    glEnable(GL_SCISSOR_TEST);
+}
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <unistd.h>
+
+#include "viscor/result-cache.h"
+
+using namespace VisCor;
+
+namespace {
+constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+/* Magic, payload size, payload checksum */
+constexpr char magic[8] = {'V', 'I', 'S', 'C', 'O', 'R', '0', '2'};
+constexpr size_t headerBytes = sizeof(magic) + 2 * sizeof(uint64_t);
+
+std::atomic<uint64_t> tmpCounter = 0;
+
+uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+uint64_t mixRound(uint64_t acc, uint64_t input) {
+  return rotl(acc + input * prime2, 31) * prime1;
+}
+
+uint64_t avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+/* Streaming xxhash64-like hash; the lanes let the multiplies overlap */
+class Hasher {
+public:
+  Hasher(uint64_t seed = 0)
+      : _lanes{seed + prime1 + prime2, seed + prime2, seed, seed - prime1} {}
+
+  void update(const void *data, size_t bytes) {
+    const auto *p = (const unsigned char *)data;
+    _total += bytes;
+
+    if (_buffered > 0) {
+      const auto n = std::min(bytes, sizeof(_buffer) - _buffered);
+      std::memcpy(_buffer + _buffered, p, n);
+      _buffered += n;
+      p += n;
+      bytes -= n;
+      if (_buffered < sizeof(_buffer))
+        return;
+      consume(_buffer);
+      _buffered = 0;
+    }
+    for (; bytes >= sizeof(_buffer); p += sizeof(_buffer),
+                                     bytes -= sizeof(_buffer)) {
+      consume(p);
+    }
+    std::memcpy(_buffer, p, bytes);
+    _buffered = bytes;
+  }
+
+  uint64_t digest() const {
+    uint64_t h = rotl(_lanes[0], 1) + rotl(_lanes[1], 7) +
+                 rotl(_lanes[2], 12) + rotl(_lanes[3], 18);
+    h += _total;
+    for (size_t i = 0; i < _buffered; ++i) {
+      h ^= _buffer[i] * prime5;
+      h = rotl(h, 11) * prime1;
+    }
+    return avalanche(h);
+  }
+
+private:
+  void consume(const unsigned char *block) {
+    for (int i = 0; i < 4; ++i) {
+      uint64_t word;
+      std::memcpy(&word, block + 8 * i, 8);
+      _lanes[i] = mixRound(_lanes[i], word);
+    }
+  }
+
+  std::array<uint64_t, 4> _lanes;
+  unsigned char _buffer[32];
+  size_t _buffered = 0;
+  uint64_t _total = 0;
+};
+
+std::string toHex(uint64_t h) {
+  char buf[17];
+  std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+  return buf;
+}
+
+uint64_t checksum(const void *data, size_t bytes) {
+  Hasher hasher;
+  hasher.update(data, bytes);
+  return hasher.digest();
+}
+} // namespace
+
+uint64_t VisCor::hashFileContents(const fs::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    throw std::runtime_error("Couldn't open " + path.string());
+
+  Hasher hasher;
+  std::vector<char> block(1 << 20);
+  while (in) {
+    in.read(block.data(), block.size());
+    hasher.update(block.data(), in.gcount());
+  }
+  return hasher.digest();
+}
+
+VisCor::CacheKey::CacheKey(const std::string &kind) {
+  Hasher hasher;
+  hasher.update(kind.data(), kind.size());
+  _hash = hasher.digest();
+}
+
+CacheKey &VisCor::CacheKey::add(uint64_t part) {
+  _hash = avalanche(mixRound(_hash ^ prime4, part));
+  return *this;
+}
+
+CacheKey &VisCor::CacheKey::add(const void *data, size_t bytes) {
+  Hasher hasher(_hash);
+  hasher.update(data, bytes);
+  _hash = hasher.digest();
+  return *this;
+}
+
+std::string VisCor::CacheKey::hex() const { return toHex(_hash); }
+
+VisCor::ResultCache::ResultCache(const fs::path &dir, size_t maxBytes)
+    : _dir(dir), _maxBytes(maxBytes) {
+  fs::create_directories(_dir / "files");
+  for (const auto &f : fs::directory_iterator(_dir)) {
+    if (f.is_regular_file() && f.path().extension() == ".bin") {
+      _usedBytes += f.file_size();
+    }
+  }
+}
+
+uint64_t VisCor::ResultCache::fileHash(const fs::path &path) {
+  const auto canonical = fs::weakly_canonical(path).string();
+  const auto size = fs::file_size(path);
+  const auto mtime = fs::last_write_time(path).time_since_epoch().count();
+
+  Hasher pathHasher;
+  pathHasher.update(canonical.data(), canonical.size());
+  const auto memoPath = _dir / "files" / toHex(pathHasher.digest());
+
+  {
+    std::ifstream memo(memoPath);
+    std::string memoHex;
+    uintmax_t memoSize;
+    int64_t memoMtime;
+    if (memo >> memoSize >> memoMtime >> memoHex && memoSize == size &&
+        memoMtime == mtime) {
+      return std::stoull(memoHex, nullptr, 16);
+    }
+  }
+
+  const auto hash = hashFileContents(path);
+  std::ofstream(memoPath) << size << " " << mtime << " " << toHex(hash)
+                          << std::endl;
+  return hash;
+}
+
+uint64_t VisCor::ResultCache::fileIdentity(const fs::path &path,
+                                           size_t prefixBytes) {
+  const auto canonical = fs::weakly_canonical(path).string();
+  const uint64_t size = fs::file_size(path);
+  const int64_t mtime = fs::last_write_time(path).time_since_epoch().count();
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    throw std::runtime_error("Couldn't open " + path.string());
+  std::vector<char> prefix(std::min<uint64_t>(prefixBytes, size));
+  in.read(prefix.data(), prefix.size());
+
+  Hasher hasher;
+  hasher.update(canonical.data(), canonical.size());
+  hasher.update(&size, sizeof(size));
+  hasher.update(&mtime, sizeof(mtime));
+  hasher.update(prefix.data(), in.gcount());
+  return hasher.digest();
+}
+
+fs::path VisCor::ResultCache::artifactPath(const CacheKey &key) const {
+  return _dir / (key.hex() + ".bin");
+}
+
+bool VisCor::ResultCache::get(const CacheKey &key, void *data, size_t bytes) {
+  const auto path = artifactPath(key);
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+
+  char header[headerBytes];
+  if (!in.read(header, headerBytes) ||
+      std::memcmp(header, magic, sizeof(magic)) != 0)
+    return false;
+  uint64_t storedBytes, storedChecksum;
+  std::memcpy(&storedBytes, header + sizeof(magic), sizeof(storedBytes));
+  std::memcpy(&storedChecksum, header + sizeof(magic) + sizeof(storedBytes),
+              sizeof(storedChecksum));
+  if (storedBytes != bytes || !in.read((char *)data, bytes) ||
+      checksum(data, bytes) != storedChecksum)
+    return false;
+
+  /* The mtime doubles as the last use, for eviction */
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+  return true;
+}
+
+void VisCor::ResultCache::put(const CacheKey &key, const void *data,
+                              size_t bytes) {
+  if (headerBytes + bytes > _maxBytes)
+    return;
+
+  const auto path = artifactPath(key);
+  /* Write next to the target and rename, so that a concurrent reader never
+   * sees half an artifact. The temporary name is unique per process and per
+   * put, since several viewers may share the directory */
+  const auto tmpPath =
+      fs::path(path.string() + "." + std::to_string(getpid()) + "." +
+               std::to_string(tmpCounter++) + ".tmp");
+  std::error_code ec;
+  {
+    std::ofstream out(tmpPath, std::ios::binary);
+    const uint64_t storedBytes = bytes;
+    const uint64_t storedChecksum = checksum(data, bytes);
+    out.write(magic, sizeof(magic));
+    out.write((const char *)&storedBytes, sizeof(storedBytes));
+    out.write((const char *)&storedChecksum, sizeof(storedChecksum));
+    out.write((const char *)data, bytes);
+    if (!out) {
+      out.close();
+      fs::remove(tmpPath, ec);
+      return;
+    }
+  }
+
+  std::lock_guard lock(_mutex);
+  auto replaced = fs::file_size(path, ec);
+  if (ec)
+    replaced = 0;
+  fs::rename(tmpPath, path, ec);
+  if (ec) {
+    fs::remove(tmpPath, ec);
+    return;
+  }
+  _usedBytes += headerBytes + bytes - replaced;
+  if (_usedBytes > _maxBytes) {
+    evict();
+  }
+}
+
+void VisCor::ResultCache::evict() {
+  struct Artifact {
+    fs::file_time_type lastUse;
+    uintmax_t size;
+    fs::path path;
+  };
+  std::vector<Artifact> artifacts;
+  _usedBytes = 0;
+  /* Other processes may add or evict artifacts while we scan; anything that
+   * can't be read is skipped rather than thrown back into the render loop */
+  std::error_code ec;
+  for (fs::directory_iterator it(_dir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (!it->is_regular_file(ec) || it->path().extension() != ".bin")
+      continue;
+    const auto lastUse = it->last_write_time(ec);
+    if (ec)
+      continue;
+    const auto size = it->file_size(ec);
+    if (ec)
+      continue;
+    artifacts.push_back({lastUse, size, it->path()});
+    _usedBytes += size;
+  }
+  std::sort(artifacts.begin(), artifacts.end(),
+            [](const auto &a, const auto &b) { return a.lastUse < b.lastUse; });
+
+  /* Leave some slack so that we don't rescan on every put */
+  const auto target = _maxBytes / 10 * 9;
+  for (const auto &a : artifacts) {
+    if (_usedBytes <= target)
+      break;
+    if (fs::remove(a.path, ec)) {
+      _usedBytes -= a.size;
+    }
+  }
+}
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cmath>
+#include <nlohmann/json.hpp>
+
+#include "viscor/session.h"
+
+using namespace VisCor;
+using json = nlohmann::json;
+
+VisCor::SessionRecorder::SessionRecorder(const fs::path &path)
+    : _out(path), _start(clock::now()) {
+  if (!_out)
+    throw std::runtime_error("Couldn't open " + path.string());
+}
+
+void VisCor::SessionRecorder::record(const SliceQuery &query, float alpha,
+                                     float exposure, float gamma) {
+  if (_last && _last->query == query && _last->alpha == alpha &&
+      _last->exposure == exposure && _last->gamma == gamma)
+    return;
+
+  const std::chrono::duration<double> t = clock::now() - _start;
+  _last = SessionEvent{t.count(), query, alpha, exposure, gamma};
+
+  const json j = {{"t", t.count()},         {"u0", query.u0},
+                  {"v0", query.v0},         {"iSlice", query.iSlice},
+                  {"jSlice", query.jSlice}, {"exp", query.exp},
+                  {"alpha", alpha},         {"exposure", exposure},
+                  {"gamma", gamma}};
+  _out << j.dump() << std::endl;
+}
+
+std::string VisCor::LatencyReport::json() const {
+  const nlohmann::json j = {
+      {"events", events},
+      {"presented", presented},
+      {"dropped", dropped},
+      {"late", late},
+      {"latency_ms", {{"p50", p50}, {"p90", p90}, {"p99", p99}, {"max", max}}}};
+  return j.dump(2);
+}
+
+VisCor::SessionReplay::SessionReplay(const fs::path &path,
+                                     double frameBudgetMs)
+    : _frameBudgetMs(frameBudgetMs) {
+  std::ifstream in(path);
+  if (!in)
+    throw std::runtime_error("Couldn't open " + path.string());
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty())
+      continue;
+    const auto j = json::parse(line);
+
+    SessionEvent e;
+    e.t = j.at("t");
+    e.query.u0 = j.at("u0");
+    e.query.v0 = j.at("v0");
+    e.query.iSlice = j.at("iSlice");
+    e.query.jSlice = j.at("jSlice");
+    e.query.exp = j.at("exp");
+    e.alpha = j.at("alpha");
+    e.exposure = j.value("exposure", 0.0f);
+    e.gamma = j.value("gamma", 2.2f);
+    _events.push_back(e);
+  }
+}
+
+void VisCor::SessionReplay::apply(ImHeatSlice &view) {
+  const auto now = clock::now();
+  if (!_start)
+    _start = now;
+
+  const auto due = [&](const SessionEvent &e) {
+    return *_start + std::chrono::duration_cast<clock::duration>(
+                         std::chrono::duration<double>(e.t));
+  };
+
+  while (_next < _events.size() && due(_events[_next]) <= now) {
+    const auto &e = _events[_next++];
+    if (_pending) {
+      ++_dropped;
+    }
+    _pending = due(e);
+
+    view.newQuery = e.query;
+    view.alpha = e.alpha;
+    view.exposure = e.exposure;
+    view.gamma = e.gamma;
+  }
+}
+
+void VisCor::SessionReplay::presented() {
+  if (!_pending)
+    return;
+  const std::chrono::duration<double, std::milli> latency =
+      clock::now() - *_pending;
+  _latencies.push_back(latency.count());
+  _pending.reset();
+}
+
+bool VisCor::SessionReplay::done() const {
+  return _next == _events.size() && !_pending;
+}
+
+LatencyReport VisCor::SessionReplay::report() const {
+  LatencyReport r;
+  r.events = _events.size();
+  r.presented = _latencies.size();
+  r.dropped = _dropped;
+  r.late = std::count_if(_latencies.begin(), _latencies.end(),
+                         [&](double l) { return l > _frameBudgetMs; });
+
+  if (_latencies.empty())
+    return r;
+
+  auto sorted = _latencies;
+  std::sort(sorted.begin(), sorted.end());
+  const auto percentile = [&](double p) {
+    const auto idx = (size_t)std::ceil(p * sorted.size()) - 1;
+    return sorted[std::min(idx, sorted.size() - 1)];
+  };
+  r.p50 = percentile(.5);
+  r.p90 = percentile(.9);
+  r.p99 = percentile(.99);
+  r.max = sorted.back();
+  return r;
+}
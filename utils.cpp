@@ -2,51 +2,99 @@
 #include <regex>
 #include <torch/torch.h>
 
+#include "viscor/catalog.h"
+#include "viscor/memory.h"
 #include "viscor/utils.h"
 
 using namespace VisCor;
 
-Uint8Image VisCor::oiioLoadImage(const std::string &filename) {
+HalfImage VisCor::oiioLoadImageHalf(const std::string &filename,
+                                    int threads) {
   using namespace OIIO;
 
   auto in = ImageInput::open(filename);
   if (!in)
     throw std::runtime_error("Couldn't load the image");
+  in->threads(threads);
 
   const ImageSpec &spec = in->spec();
-  int xres = spec.width;
-  int yres = spec.height;
-  int channels = spec.nchannels;
-  std::unique_ptr<unsigned char[]> data =
-      std::make_unique<unsigned char[]>(xres * yres * channels);
+  const int xres = spec.width;
+  const int yres = spec.height;
+  const int channels = std::min(spec.nchannels, 4);
+  const auto colorSpace = spec.get_string_attribute("oiio:ColorSpace");
+  const bool linear = colorSpace == "Linear" ||
+                      (colorSpace.empty() && spec.format.is_floating_point());
 
-  if (!data)
-    throw std::runtime_error("Couldn't allocate memory for image data");
+  auto data = std::make_unique<uint16_t[]>((size_t)xres * yres * channels);
+  if (!in->read_image(0, channels, TypeDesc::HALF, data.get()))
+    throw std::runtime_error("Couldn't read " + filename + ": " +
+                             in->geterror());
+  in->close();
 
-  in->read_image(TypeDesc::UINT8, data.get());
-  in->close(); /* eh... why not raii, I now have to wrap it in try-catch and I
-                  don't want to */
+  return HalfImage(xres, yres, channels, linear, std::move(data));
+}
+
+std::tuple<int, int, int>
+VisCor::exrFieldShape(const fs::path &path, const std::string &scoreChannel) {
+  using namespace OIIO;
+  std::unique_ptr<ImageInput> in = ImageInput::open(path);
+  if (!in)
+    throw std::runtime_error("Couldn't open " + path.string());
+  const ImageSpec &spec = in->spec();
+  return std::make_tuple(spec.height, spec.width,
+                         (int)descriptorChannels(spec, scoreChannel).size());
+}
+
+torch::ScalarType
+VisCor::fieldsPrecision(const std::vector<std::string> &paths,
+                        const std::string &scoreChannel) {
+  size_t count = 0;
+  for (const auto &path : paths) {
+    const auto [h, w, c] = exrFieldShape(path, scoreChannel);
+    count += (size_t)h * w * c;
+  }
+  const auto &registry = MemoryRegistry::instance();
+  if (registry.fits(count * sizeof(float))) {
+    return torch::kF32;
+  }
+  if (registry.fits(count * sizeof(uint16_t))) {
+    std::cerr << "Loading the featuremaps at half precision to fit in the "
+              << "memory budget" << std::endl;
+    return torch::kF16;
+  }
+  throw std::runtime_error("The featuremaps don't fit in the memory budget");
+}
 
-  return Uint8Image(xres, yres, channels, std::move(data));
+namespace {
+/* Reads the channels of an open EXR into dst, a contiguous [C, H, W] cpu
+ * tensor of halves or floats */
+void readDescriptorChannels(OIIO::ImageInput &in,
+                            const std::vector<std::string> &channels,
+                            torch::Tensor dst) {
+  using namespace OIIO;
+  const ImageSpec &spec = in.spec();
+  const TypeDesc format =
+      dst.scalar_type() == torch::kF16 ? TypeDesc::HALF : TypeDesc::FLOAT;
+  auto *p = (char *)dst.data_ptr();
+  const auto channelBytes = spec.width * spec.height * dst.element_size();
+  for (const auto &c : channels) {
+    const auto channelIdx = spec.channelindex(c);
+    in.read_image(channelIdx, channelIdx + 1, format, p);
+    p += channelBytes;
+  }
 }
+} // namespace
 
 // FIXME: rm shitcode
 DescriptorField VisCor::loadExrField(const fs::path &path,
-                                     const torch::Device &device) {
+                                     const torch::Device &device,
+                                     torch::ScalarType dtype,
+                                     const std::string &scoreChannel) {
   using namespace OIIO;
   std::unique_ptr<ImageInput> in = ImageInput::open(path);
   const ImageSpec &spec = in->spec();
 
-  std::vector<std::string> descChannels;
-  for (const auto &c : spec.channelnames) {
-    // if (!c.starts_with("superglue."))
-    //   continue;
-
-    //   FIXME:
-    if (c.find(".") == std::string::npos)
-      continue;
-    descChannels.push_back(c);
-  }
+  const auto descChannels = descriptorChannels(spec, scoreChannel);
 
   const auto nChannels = descChannels.size();
   const auto shape = std::make_tuple(spec.height, spec.width, nChannels);
@@ -59,20 +107,207 @@ DescriptorField VisCor::loadExrField(const fs::path &path,
     throw std::runtime_error("Input has 0 channels");
   }
 
+  const size_t count = nChannels * spec.height * spec.width;
+  if (!MemoryRegistry::instance().fits(count * c10::elementSize(dtype))) {
+    throw std::runtime_error(path.string() +
+                             " doesn't fit in the memory budget");
+  }
+
   DescriptorField f;
   f.shape = shape;
 
   f.data = torch::empty({(long)nChannels, spec.height, spec.width},
-                        torch::TensorOptions().dtype(torch::kF32));
+                        torch::TensorOptions().dtype(dtype));
+  readDescriptorChannels(*in, descChannels, f.data);
 
-  long offset = 0;
-  for (const auto &c : descChannels) {
-    const auto channelIdx = spec.channelindex(c);
-    in->read_image(channelIdx, channelIdx + 1, TypeDesc::FLOAT,
-                   f.data.data_ptr<float>() + offset);
-    offset += spec.width * spec.height;
+  f.data = f.data.to(device);
+  if (f.data.is_cpu() && dtype == torch::kF32) {
+    f.kernel = selectHeatKernel(nChannels);
   }
-
-  f.data = f.data.clone().to(device);
+  if (f.kernel) {
+    std::cerr << "Using " << f.kernel.name << " for " << path << std::endl;
+  }
+  f.memory = MemoryLease("Descriptors", path.filename().string(),
+                         f.data.numel() * f.data.element_size());
   return f;
 }
+
+DescriptorBatch
+VisCor::loadExrFieldBatch(const std::vector<std::string> &paths,
+                          const torch::Device &device,
+                          const std::string &scoreChannel) {
+  using namespace OIIO;
+  if (paths.empty()) {
+    throw std::runtime_error("Expected at least one featuremap");
+  }
+  const auto shape = exrFieldShape(paths.front(), scoreChannel);
+  for (const auto &path : paths) {
+    if (exrFieldShape(path, scoreChannel) != shape) {
+      throw std::runtime_error("All second featuremaps must have the same "
+                               "shape");
+    }
+  }
+  const auto [h, w, c] = shape;
+  if (c < 1) {
+    throw std::runtime_error("Input has 0 channels");
+  }
+
+  const auto dtype = fieldsPrecision(paths, scoreChannel);
+  DescriptorBatch batch;
+  batch.data = torch::empty({(long)paths.size(), c, h, w},
+                            torch::TensorOptions().dtype(dtype).device(device));
+  batch.memory = MemoryLease("Descriptors", "second featuremaps",
+                             batch.data.numel() * batch.data.element_size());
+
+  /* Off the cpu each field goes through one reused staging field */
+  torch::Tensor staging;
+  MemoryLease stagingMemory;
+  if (!batch.data.is_cpu()) {
+    staging = torch::empty({c, h, w}, torch::TensorOptions().dtype(dtype));
+    stagingMemory = MemoryLease("Descriptors", "staging",
+                                staging.numel() * staging.element_size());
+  }
+
+  for (size_t n = 0; n < paths.size(); ++n) {
+    std::unique_ptr<ImageInput> in = ImageInput::open(paths[n]);
+    if (!in)
+      throw std::runtime_error("Couldn't open " + paths[n]);
+
+    DescriptorField f;
+    f.shape = shape;
+    f.data = batch.data.select(0, n);
+    const auto channels = descriptorChannels(in->spec(), scoreChannel);
+    if (staging.defined()) {
+      readDescriptorChannels(*in, channels, staging);
+      f.data.copy_(staging);
+    } else {
+      readDescriptorChannels(*in, channels, f.data);
+    }
+    if (f.data.is_cpu() && dtype == torch::kF32) {
+      f.kernel = selectHeatKernel(c);
+    }
+    batch.fields.push_back(std::move(f));
+  }
+  if (batch.fields.front().kernel) {
+    std::cerr << "Using " << batch.fields.front().kernel.name
+              << " for the second featuremaps" << std::endl;
+  }
+  return batch;
+}
+
+VisCor::LazyExrField::LazyExrField(const fs::path &path,
+                                   const torch::Device &device, float cacheMB,
+                                   const std::string &scoreChannel)
+    : _path(path.string()), _cache(OIIO::ImageCache::create(false)),
+      _device(device),
+      _memory("Caches", path.filename().string() + " tiles",
+              (size_t)(cacheMB * (1 << 20))) {
+  using namespace OIIO;
+  /* The cache evicts tiles on its own once it's full */
+  _cache->attribute("max_memory_MB", cacheMB);
+  _cache->attribute("autotile", 64);
+
+  ImageSpec spec;
+  if (!_cache->get_imagespec(_path, spec)) {
+    const auto error = _cache->geterror();
+    ImageCache::destroy(_cache);
+    throw std::runtime_error("Couldn't open " + path.string() + ": " + error);
+  }
+
+  std::vector<int64_t> channels;
+  for (const auto &c : descriptorChannels(spec, scoreChannel)) {
+    channels.push_back(spec.channelindex(c));
+  }
+  if (channels.empty()) {
+    ImageCache::destroy(_cache);
+    throw std::runtime_error("Input has 0 channels");
+  }
+
+  _shape = std::make_tuple(spec.height, spec.width, (int)channels.size());
+  _x0 = spec.x;
+  _y0 = spec.y;
+  _chBegin = channels.front();
+  _chEnd = channels.back() + 1;
+  _chIndex = torch::tensor(channels, torch::TensorOptions().dtype(torch::kInt64))
+                 .sub(_chBegin);
+}
+
+VisCor::LazyExrField::~LazyExrField() { OIIO::ImageCache::destroy(_cache); }
+
+torch::Tensor VisCor::LazyExrField::operator()(const int i, const int j) const {
+  using namespace OIIO;
+  auto pixel = torch::empty({_chEnd - _chBegin},
+                            torch::TensorOptions().dtype(torch::kF32));
+  if (!_cache->get_pixels(_path, 0, 0, _x0 + j, _x0 + j + 1, _y0 + i,
+                          _y0 + i + 1, 0, 1, _chBegin, _chEnd, TypeDesc::FLOAT,
+                          pixel.data_ptr<float>())) {
+    throw std::runtime_error("Couldn't read " + _path.string() + ": " +
+                             _cache->geterror());
+  }
+  if (_chEnd - _chBegin != c()) {
+    pixel = pixel.index_select(0, _chIndex);
+  }
+  return pixel.to(_device);
+}
+
+torch::Tensor VisCor::Keypoints::gather(const DescriptorField &field) const {
+  using namespace torch::indexing;
+  const auto onDevice = ij.to(field.data.device());
+  return field.data.index({Slice(), onDevice.select(1, 0), onDevice.select(1, 1)})
+      .t()
+      .contiguous();
+}
+
+Keypoints VisCor::loadKeypointsJson(const fs::path &path, int h, int w) {
+  using json = nlohmann::json;
+  std::ifstream fKeypoints(path);
+  if (!fKeypoints)
+    throw std::runtime_error("Couldn't open " + path.string());
+  json j;
+  fKeypoints >> j;
+
+  const auto &xys = j.at("keypoints");
+  std::vector<int64_t> ij;
+  ij.reserve(2 * xys.size());
+  for (const auto &xy : xys) {
+    const auto x = (int64_t)std::floor(xy.at(0).get<double>());
+    const auto y = (int64_t)std::floor(xy.at(1).get<double>());
+    if (x < 0 || y < 0 || x >= w || y >= h)
+      continue;
+    ij.push_back(y);
+    ij.push_back(x);
+  }
+
+  Keypoints kps;
+  kps.ij = torch::tensor(ij, torch::TensorOptions().dtype(torch::kInt64))
+               .reshape({-1, 2});
+  return kps;
+}
+
+Keypoints VisCor::keypointsFromScoreChannel(const fs::path &path,
+                                            const std::string &channel,
+                                            double threshold, int maxCount) {
+  using namespace OIIO;
+  std::unique_ptr<ImageInput> in = ImageInput::open(path);
+  if (!in)
+    throw std::runtime_error("Couldn't open " + path.string());
+  const ImageSpec &spec = in->spec();
+
+  const auto channelIdx = spec.channelindex(channel);
+  if (channelIdx < 0)
+    throw std::runtime_error("No channel " + channel + " in " + path.string());
+
+  auto score = torch::empty({spec.height * spec.width},
+                            torch::TensorOptions().dtype(torch::kF32));
+  in->read_image(channelIdx, channelIdx + 1, TypeDesc::FLOAT,
+                 score.data_ptr<float>());
+
+  const auto k = std::min<long>(maxCount, score.size(0));
+  const auto [topScore, topIdx] = score.topk(k);
+  const auto idx = topIdx.index({topScore > threshold});
+
+  Keypoints kps;
+  kps.ij = torch::stack({idx.floor_divide(spec.width), idx.remainder(spec.width)},
+                        1);
+  return kps;
+}